@@ -0,0 +1,102 @@
+/*---------------------------------------------------------------------------*/
+// Copyright (c) 2022 ETH Zurich.
+// All rights reserved.
+//
+// This file is distributed under the terms in the attached LICENSE file.
+// If you do not find this file, copies can be found by writing to:
+// ETH Zurich D-INFK, Stampfenbachstrasse 114, CH-8092 Zurich. Attn: Systems Group
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Enzian L2 residency
+ *
+ * Reads the L2 tags through the Load Tag ioctl of /dev/fpgamem (11, index in, tag out)
+ * and counts the resident, dirty and locked lines per physical address range
+ */
+
+#ifndef ENZIAN_L2_H
+#define ENZIAN_L2_H
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+// L2 of the ThunderX CN88xx, 16MB, 16 ways of 8192 sets of 128B lines
+#define L2_WAYS         16
+#define L2_SETS         8192
+#define L2_LINE         128
+#define L2_IOCTL_LTG    11
+
+// Index operand of the index operations, the way above the set
+#define L2_INDEX(set, way) (((uint64_t)(way) << 20) | ((uint64_t)(set) << 7))
+// Set of a physical address, the bits 19:7 XORed with the bits above, L2C_CTL[DISIDXALIAS] clear
+#define L2_SET(addr) ((((uint64_t)(addr) >> 7) ^ ((uint64_t)(addr) >> 20)) & (L2_SETS - 1))
+
+// Tag as loaded by CVMCACHELTGL2I, the address bits are in place
+#define L2_TAG_VALID(t)     ((t) & 1)
+#define L2_TAG_DIRTY(t)     (((t) >> 1) & 1)
+#define L2_TAG_LOCK(t)      (((t) >> 2) & 1)
+#define L2_TAG_ADDR_MASK    0x0000fffffff00000UL
+// The set is the address bits 19:7 XORed with the tag bits above, L2C_CTL[DISIDXALIAS] clear
+#define L2_TAG_ADDR(t, set) (((t) & L2_TAG_ADDR_MASK) | ((((uint64_t)(set) ^ ((t) >> 20)) & (L2_SETS - 1)) << 7))
+
+#define FPGA_MEMORY_ADDRESS 0x10000000000UL
+#define FPGA_MEMORY_SIZE    0x10000000000UL
+
+// Lines of a physical address range, [start, end)
+struct l2_range {
+    char name[64];
+    uint64_t start, end;
+    uint64_t resident, dirty, locked;
+};
+
+static inline int l2_open(const char *path)
+{
+    return open(path ? path : "/dev/fpgamem", O_RDWR);
+}
+
+// Read the tag of a set and way, 0 on success
+static inline int l2_read_tag(int fd, unsigned set, unsigned way, uint64_t *tag)
+{
+    uint64_t req[2] = {L2_INDEX(set, way), 0};
+
+    if (ioctl(fd, L2_IOCTL_LTG, req) != 0)
+        return -1;
+    *tag = req[1];
+    return 0;
+}
+
+// Count the valid lines of all the sets and ways in the ranges, the rest in *other, 0 on success
+static inline int l2_scan(int fd, struct l2_range *ranges, unsigned n, uint64_t *other)
+{
+    unsigned set, way, i;
+    uint64_t tag, addr;
+
+    for (i = 0; i < n; i++)
+        ranges[i].resident = ranges[i].dirty = ranges[i].locked = 0;
+    if (other)
+        *other = 0;
+    for (set = 0; set < L2_SETS; set++) {
+        for (way = 0; way < L2_WAYS; way++) {
+            if (l2_read_tag(fd, set, way, &tag) != 0)
+                return -1;
+            if (!L2_TAG_VALID(tag))
+                continue;
+            addr = L2_TAG_ADDR(tag, set);
+            for (i = 0; i < n && (addr < ranges[i].start || addr >= ranges[i].end); i++)
+                ;
+            if (i == n) {
+                if (other)
+                    (*other)++;
+                continue;
+            }
+            ranges[i].resident++;
+            ranges[i].dirty += L2_TAG_DIRTY(tag);
+            ranges[i].locked += L2_TAG_LOCK(tag);
+        }
+    }
+    return 0;
+}
+
+#endif
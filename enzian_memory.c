@@ -18,11 +18,18 @@
 #include <linux/mm.h>
 #include <linux/pfn_t.h>
 #include <linux/smp.h>
+#include <linux/uaccess.h>
 
 #include <asm/arch_gicv3.h>
 
 #define FPGA_MEMORY_ADDRESS 0x10000000000ULL
 
+// Implementation defined register CVMCACHELTGL2I loads the L2 tag into, see the ThunderX HRM
+#define CVM_L2_TAG_SYSREG "s3_0_c11_c8_6"
+// And the ones CVMCACHERDUTLB/CVMCACHERDMTLB load the entry into, the virtual and the physical side
+#define CVM_TLB_VA_SYSREG "s3_0_c11_c8_2"
+#define CVM_TLB_PA_SYSREG "s3_0_c11_c8_3"
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Adam S. Turowski");
 MODULE_DESCRIPTION("Enzian FPGA memory driver.");
@@ -87,6 +94,37 @@ long int enzian_memory_ioctl(struct file *file, unsigned int cmd, unsigned long
     case 10: // PREFu, SYS CVMCACHEPREFUTLB, Xt
         asm volatile("sys #0,c11,c2,#0,%0 \n" :: "r" (arg));
         break;
+    case 11: { // L2 Cache Index Load Tag and read it back, arg points to {index, tag}
+        uint64_t req[2];
+
+        if (copy_from_user(req, (void __user *)arg, sizeof(req)))
+            return -EFAULT;
+        preempt_disable(); // load and read on the same core
+        asm volatile("sys #0,c11,c0,#7,%0 \n" :: "r" (req[0]));
+        asm volatile("isb \n mrs %0," CVM_L2_TAG_SYSREG " \n" : "=r" (req[1]));
+        preempt_enable();
+        if (copy_to_user((void __user *)arg, req, sizeof(req)))
+            return -EFAULT;
+        break;
+    }
+    case 12: // uTLB read and read the entry back, arg points to {index, va, pa}, the TLBs of the calling core
+    case 13: { // MTLB read and read the entry back
+        uint64_t req[3];
+
+        if (copy_from_user(req, (void __user *)arg, sizeof(req)))
+            return -EFAULT;
+        preempt_disable();
+        if (cmd == 12)
+            asm volatile("sys #0,c11,c1,#5,%0 \n" :: "r" (req[0]));
+        else
+            asm volatile("sys #0,c11,c1,#6,%0 \n" :: "r" (req[0]));
+        asm volatile("isb \n mrs %0," CVM_TLB_VA_SYSREG " \n" : "=r" (req[1]));
+        asm volatile("mrs %0," CVM_TLB_PA_SYSREG " \n" : "=r" (req[2]));
+        preempt_enable();
+        if (copy_to_user((void __user *)arg, req, sizeof(req)))
+            return -EFAULT;
+        break;
+    }
     default:
         return -EINVAL;
     }
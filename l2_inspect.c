@@ -0,0 +1,155 @@
+/*---------------------------------------------------------------------------*/
+// Copyright (c) 2022 ETH Zurich.
+// All rights reserved.
+//
+// This file is distributed under the terms in the attached LICENSE file.
+// If you do not find this file, copies can be found by writing to:
+// ETH Zurich D-INFK, Stampfenbachstrasse 114, CH-8092 Zurich. Attn: Systems Group
+/*---------------------------------------------------------------------------*/
+
+/*
+ * Enzian L2 residency inspector
+ *
+ * Walks all the L2 sets and ways with the Load Tag ioctl and reports the resident, dirty and locked
+ * lines per physical address range, the FPGA memory and the DRAM by default
+ * With -n, takes several snapshots and reports the lines lost since the first one,
+ * e.g. to measure how much a co-runner evicts a working set
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <getopt.h>
+#include <time.h>
+#include "enzian_l2.h"
+
+#define MAX_RANGES 16
+
+struct l2_range ranges[MAX_RANGES];
+unsigned no_ranges;
+
+// Parse a range, name:start:size, the values in hex (with or without "0x")
+void parse_range(const char *spec)
+{
+    struct l2_range *r = ranges + no_ranges;
+    const char *start = strchr(spec, ':');
+    char *end;
+    uint64_t size;
+
+    if (no_ranges == MAX_RANGES || !start || start == spec || start - spec >= (int)sizeof(r->name)) {
+        fprintf(stderr, "Invalid range: %s\n", spec);
+        exit(1);
+    }
+    memcpy(r->name, spec, start - spec);
+    r->name[start - spec] = 0;
+    r->start = strtoull(start + 1, &end, 16);
+    if (*end != ':') {
+        fprintf(stderr, "Invalid range: %s\n", spec);
+        exit(1);
+    }
+    size = strtoull(end + 1, &end, 16);
+    if (*end || size == 0) {
+        fprintf(stderr, "Invalid range: %s\n", spec);
+        exit(1);
+    }
+    r->end = r->start + size;
+    no_ranges++;
+}
+
+void print_snapshot(const uint64_t *first, uint64_t other)
+{
+    unsigned i;
+    uint64_t total = (uint64_t)L2_SETS * L2_WAYS;
+
+    printf("%-16s %10s %10s %10s %8s", "Range", "Resident", "Dirty", "Locked", "Of L2");
+    if (first)
+        printf(" %10s", "Lost");
+    printf("\n");
+    for (i = 0; i < no_ranges; i++) {
+        printf("%-16s %10ld %10ld %10ld %7.2f%%", ranges[i].name, ranges[i].resident, ranges[i].dirty, ranges[i].locked,
+            100.0 * ranges[i].resident / total);
+        if (first)
+            printf(" %10ld", first[i] > ranges[i].resident ? first[i] - ranges[i].resident : 0);
+        printf("\n");
+    }
+    printf("%-16s %10ld %10s %10s %7.2f%%\n", "other", other, "", "", 100.0 * other / total);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = NULL;
+    uint64_t first[MAX_RANGES];
+    uint64_t other;
+    unsigned count = 1, n, i;
+    double interval = 1.0;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "hd:r:n:i:")) != -1) {
+        switch (opt) {
+        case 'h':
+            puts("Usage: l2_inspect [-h] [-d device] [-r name:start:size]... [-n count] [-i interval]");
+            puts("-h");
+            puts("      Print this help");
+            puts("-d device");
+            puts("      The FPGA memory device, /dev/fpgamem by default");
+            puts("-r name:start:size");
+            puts("      A physical address range to report, in hex, up to 16 of them, the first matching one counts.");
+            puts("      By default the FPGA memory and the DRAM below it");
+            puts("-n count");
+            puts("      Number of snapshots, the later ones report the lines lost since the first one");
+            puts("-i interval");
+            puts("      Time between the snapshots in seconds, 1 by default");
+            return 0;
+        case 'd':
+            device = optarg;
+            break;
+        case 'r':
+            parse_range(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'i':
+            interval = atof(optarg);
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (no_ranges == 0) {
+        snprintf(ranges[0].name, sizeof(ranges[0].name), "fpga");
+        ranges[0].start = FPGA_MEMORY_ADDRESS;
+        ranges[0].end = FPGA_MEMORY_ADDRESS + FPGA_MEMORY_SIZE;
+        snprintf(ranges[1].name, sizeof(ranges[1].name), "dram");
+        ranges[1].start = 0;
+        ranges[1].end = FPGA_MEMORY_ADDRESS;
+        no_ranges = 2;
+    }
+
+    fd = l2_open(device);
+    if (fd < 0) {
+        perror(device ? device : "/dev/fpgamem");
+        return 1;
+    }
+    for (n = 0; n < count; n++) {
+        if (n > 0) {
+            struct timespec ts = {(time_t)interval, (long)((interval - (time_t)interval) * 1000000000.0)};
+
+            nanosleep(&ts, NULL);
+        }
+        if (l2_scan(fd, ranges, no_ranges, &other) != 0) {
+            perror("Load tag");
+            return 1;
+        }
+        if (count > 1)
+            printf("Snapshot %d\n", n);
+        print_snapshot(n ? first : NULL, other);
+        if (n == 0)
+            for (i = 0; i < no_ranges; i++)
+                first[i] = ranges[i].resident;
+    }
+    close(fd);
+    return 0;
+}
@@ -12,6 +12,9 @@
  *
  * Latency and bandwidth memory benchmark using 1G hugepages
  * Core-to-core latency benchmark
+ * Copy bandwidth benchmark between the CPU and FPGA memory
+ * The tested memory is the FPGA memory by default, or any of the backends selectable with -M,
+ * it builds on aarch64 and x86_64
  * To allocate huge pages in the main memory, do:
  * echo 3 > /sys/devices/system/node/node0/hugepages/hugepages-1048576kB/nr_hugepages
  */
@@ -27,16 +30,29 @@
 #include <linux/mman.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
+#include <getopt.h>
 #include <sys/sysinfo.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <linux/mempolicy.h>
+#include <sys/stat.h>
+#include <sys/auxv.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include "enzian_l2.h"
+#ifdef __aarch64__
+#include <asm/hwcap.h>
+#endif
+#ifdef __amd64__
+#include <emmintrin.h>
+#endif
 
-#define SIZE_EXP 26
-#define SIZE (1UL << SIZE_EXP)
-#define MASK ((SIZE / 8) - 1)
-#define COUNT (SIZE)
-#define STRIDE ((128) * 16)
-#define CACHELINE_SIZE 128
+#define CACHELINE_SIZE 128  // largest line size, for the layout, the detected one is line_size
 
 
 static __inline__ uint64_t rdtsc(void)
@@ -64,6 +80,61 @@ static __inline__ void cache_flush(volatile void *m)
 #endif
 }
 
+// Clean without invalidating, x86 has nothing comparable everywhere
+static __inline__ void cache_clean(volatile void *m)
+{
+#ifdef __aarch64__
+    __asm__ __volatile__(" dc cvac,%0\n" :: "r" (m));
+#else
+    (void)m;
+#endif
+}
+
+// Wait for the outstanding memory and cache maintenance operations
+static __inline__ void mem_barrier(void)
+{
+#ifdef __aarch64__
+    __asm__ __volatile__(" dsb sy\n" ::: "memory");
+#endif
+#ifdef __amd64__
+    __asm__ __volatile__(" mfence\n" ::: "memory");
+#endif
+}
+
+// Zero a cache line without reading it first
+static __inline__ void zero_line(void *d)
+{
+#ifdef __aarch64__
+    asm volatile("dc zva, %0" : : "r" (d) : "memory");
+#endif
+#ifdef __amd64__
+    __m128i z = _mm_setzero_si128();
+    _mm_stream_si128((__m128i *)d + 0, z);
+    _mm_stream_si128((__m128i *)d + 1, z);
+    _mm_stream_si128((__m128i *)d + 2, z);
+    _mm_stream_si128((__m128i *)d + 3, z);
+    _mm_stream_si128((__m128i *)d + 4, z);
+    _mm_stream_si128((__m128i *)d + 5, z);
+    _mm_stream_si128((__m128i *)d + 6, z);
+    _mm_stream_si128((__m128i *)d + 7, z);
+#endif
+}
+
+// Order the non-temporal stores
+static __inline__ void nt_fence(void)
+{
+#ifdef __amd64__
+    _mm_sfence();
+#endif
+}
+
+// Inline asm constraint of a vector register
+#ifdef __aarch64__
+#define VEC_REG "w"
+#else
+#define VEC_REG "x"
+#endif
+
 // SIMD types to fit in a 128-bit vector register, 8 vector in a cache line
 // 4 * float
 typedef float v4f __attribute__    ((vector_size (16)));
@@ -72,18 +143,44 @@ typedef v4f cacheline_float_t[8];
 typedef uint64_t v2i __attribute__ ((vector_size (16)));
 typedef v2i cacheline_uint64_t[8];
 
-unsigned first_cpu, last_cpu, use_cpu_memory, do_overall, do_cache_to_cache, do_latency, do_seq_latency, do_throughput, do_stress;
+unsigned c2c_concurrency, use_cpu_memory, do_perf, do_overall, do_cache_to_cache, do_latency, do_seq_latency, do_throughput, do_stress, do_copy, do_stride, do_mix, do_atomic, do_cmo, do_ring, do_scaling, do_tlb;
+FILE *prefetch_profile_out;
+int do_prefetch_tuning_mode;
+
+// Selected cores, one pinned worker per core
+unsigned cpu_list[CPU_SETSIZE];
+unsigned no_threads;
+char cpu_list_text[256];
 
 void *area = NULL;
+void *dram_area = NULL; // second region, always in the CPU memory, used by the copy test
+void *copy_src, *copy_dst;
+unsigned copy_kernel;
 double rate = 1.0;
 uint64_t itn;
 uint64_t no_cpus = 1;
-uint64_t l2_cache_size;
+uint64_t l2_cache_size;     // share of the last level cache of every thread
 uint64_t area_test_size = 0;
 
+// Sizes per thread of the sweeps, and of the area of the backends, see -R and -A
+uint64_t sweep_min = 1UL << 14;
+uint64_t sweep_max;         // 0 for the default of every test
+uint64_t area_size;         // 0 for enough for the selected tests
+uint64_t copy_size;         // size of both sides of the copy test
+
 // Barrier to launch threads simultaneously
 pthread_barrier_t barrier;
 
+// Topology of the host, detected at start, the defaults are the ThunderX ones
+uint64_t line_size = CACHELINE_SIZE;    // smallest data cache line
+uint64_t zva_size = CACHELINE_SIZE;     // block zeroed by zero_line, 0 if DC ZVA is prohibited
+uint64_t l1_cache_size = 32768;
+uint64_t llc_size = 16777216;           // last level cache
+unsigned llc_level = 2;
+cpu_set_t llc_cpus;                     // cores sharing the last level cache with the first one
+uint64_t counter_freq;                  // 0 if the counter needs calibrating
+double cpu_ghz;                         // core clock, for the cycles of the latencies
+
 
 uint64_t now(void)
 {
@@ -97,20 +194,24 @@ uint64_t now1(void)
     return ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-const char * nice_size(unsigned int size)
+const char * nice_size(uint64_t size)
 {
-    static char text[64];
+    static char text[4][64];
+    static unsigned next;
+    char *t = text[next++ % 4]; // several sizes in one printf
 
     if (size < 1024) {
-        snprintf(text, sizeof(text), "%9d", size);
+        snprintf(t, sizeof(text[0]), "%9ld", size);
     } else if (size < 1048576) {
-        snprintf(text, sizeof(text), "%9dk", size / 1024);
+        snprintf(t, sizeof(text[0]), "%9ldk", size / 1024);
     } else if (size < 1048576 * 1024) {
-        snprintf(text, sizeof(text), "%9dM", size / 1024 / 1024);
+        snprintf(t, sizeof(text[0]), "%9ldM", size / 1024 / 1024);
+    } else if (size < 1048576UL * 1048576) {
+        snprintf(t, sizeof(text[0]), "%9ldG", size / 1024 / 1024 / 1024);
     } else {
-        snprintf(text, sizeof(text), "%9dG", size / 1024 / 1024 / 1024);
+        snprintf(t, sizeof(text[0]), "%9ldT", size / 1024 / 1024 / 1024 / 1024);
     }
-    return text;
+    return t;
 }
 
 const char * nice_time(double t)
@@ -130,35 +231,724 @@ const char * nice_time(double t)
     return text;
 }
 
-// Start a thread on multiple cores and collect the results
-uint64_t start_threads(uint64_t first_cpu, uint64_t last_cpu, void * (*thread_func)(void *))
+// Memory backends, the tested area is mapped from one of them
+#define BACKEND_FPGAMEM 0 // FPGA memory device, the whole 1TB window at a fixed address
+#define BACKEND_HUGETLB 1 // anonymous HugeTLB pages
+#define BACKEND_MEMFD   2 // memfd, optionally backed by HugeTLB pages
+#define BACKEND_FILE    3 // shared mapping of a file
+#define BACKEND_NUMA    4 // anonymous memory bound to a NUMA node
+#define MAX_BACKENDS    16
+
+#define FPGA_MEMORY_VIRT 0x100000000000UL // 1TB aligned, same as the physical FPGA memory address for convenience
+#define FPGA_MEMORY_SIZE 0x10000000000UL  // 1TB
+#define CPU_MEMORY_SIZE  (3UL << 30)      // the default, 64MB for 48 threads
+
+struct backend {
+    int type;
+    char spec[256];         // as given on the command line
+    char path[256];         // device or file
+    uint64_t page_size;     // 0 for the default pages
+    int node;               // NUMA node
+    uint64_t size;          // mapped size
+    uint64_t used;          // size the tests were given, touched when mapped
+    int fd;
+};
+
+struct backend backends[MAX_BACKENDS];
+unsigned no_backends;
+struct backend *backend;    // the mapped one
+const char *area_name = "FPGA";
+
+// Parse a decimal size with an optional K, M, G or T suffix, a leading 0 is not octal
+uint64_t parse_size(const char *text)
+{
+    char *end;
+    uint64_t v;
+
+    v = strtoull(text, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    case 't': case 'T': v <<= 40; end++; break;
+    }
+    if (end == text || (*end && *end != ':' && *end != 'B' && *end != 'b')) {
+        fprintf(stderr, "Invalid size: %s\n", text);
+        exit(1);
+    }
+    return v;
+}
+
+// Parse a backend: fpgamem[:device], hugetlb[:2M|1G], memfd[:2M|1G], file:path or numa:node[:2M|1G]
+void parse_backend(const char *spec, struct backend *b)
+{
+    const char *arg = strchr(spec, ':');
+    size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+
+    memset(b, 0, sizeof(*b));
+    snprintf(b->spec, sizeof(b->spec), "%s", spec);
+    b->fd = -1;
+    b->size = CPU_MEMORY_SIZE;
+    if (arg)
+        arg++;
+    if (len == 7 && !strncmp(spec, "fpgamem", len)) {
+        b->type = BACKEND_FPGAMEM;
+        b->size = FPGA_MEMORY_SIZE;
+        b->page_size = 1UL << 30; // the driver inserts 1GB pages
+        snprintf(b->path, sizeof(b->path), "%s", arg ? arg : "/dev/fpgamem");
+    } else if (len == 7 && !strncmp(spec, "hugetlb", len)) {
+        b->type = BACKEND_HUGETLB;
+        b->page_size = arg ? parse_size(arg) : 1UL << 30;
+    } else if (len == 5 && !strncmp(spec, "memfd", len)) {
+        b->type = BACKEND_MEMFD;
+        b->page_size = arg ? parse_size(arg) : 0;
+    } else if (len == 4 && !strncmp(spec, "file", len) && arg) {
+        b->type = BACKEND_FILE;
+        snprintf(b->path, sizeof(b->path), "%s", arg);
+    } else if (len == 4 && !strncmp(spec, "numa", len) && arg) {
+        b->type = BACKEND_NUMA;
+        b->node = atoi(arg);
+        arg = strchr(arg, ':');
+        b->page_size = arg ? parse_size(arg + 1) : 0;
+    } else {
+        fprintf(stderr, "Unsupported memory backend: %s\n", spec);
+        exit(1);
+    }
+    if (b->page_size && (b->page_size & (b->page_size - 1))) {
+        fprintf(stderr, "Invalid page size: %s\n", spec);
+        exit(1);
+    }
+    if (b->page_size == 4096) // base pages
+        b->page_size = 0;
+}
+
+// Map the backend to the area
+void map_backend(struct backend *b)
+{
+    int huge_flags = b->page_size ? MAP_HUGETLB | (__builtin_ctzl(b->page_size) << MAP_HUGE_SHIFT) : 0;
+    struct stat st;
+
+    use_cpu_memory = 1;
+    switch (b->type) {
+    case BACKEND_FPGAMEM:
+        use_cpu_memory = 0;
+        b->fd = open(b->path, O_RDWR);
+        if (b->fd < 0) {
+            perror(b->path);
+            exit(1);
+        }
+        area = mmap((void *)FPGA_MEMORY_VIRT, b->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, b->fd, 0);
+        break;
+    case BACKEND_HUGETLB:
+        area = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | huge_flags, -1, 0);
+        if (area == MAP_FAILED) {
+            fprintf(stderr, "mmap failed. Maybe there's no enough free %s huge pages.\n", nice_size(b->page_size));
+            exit(1);
+        }
+        break;
+    case BACKEND_MEMFD:
+        b->fd = memfd_create("mb_enzian", b->page_size ? MFD_HUGETLB | (__builtin_ctzl(b->page_size) << MAP_HUGE_SHIFT) : 0); // same encoding as MFD_HUGE_*
+        if (b->fd < 0 || ftruncate(b->fd, b->size) != 0) {
+            perror("memfd");
+            exit(1);
+        }
+        area = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->fd, 0);
+        break;
+    case BACKEND_FILE:
+        b->fd = open(b->path, O_RDWR | O_CREAT, 0644);
+        if (b->fd < 0 || fstat(b->fd, &st) != 0 || ((uint64_t)st.st_size < b->size && ftruncate(b->fd, b->size) != 0)) {
+            perror(b->path);
+            exit(1);
+        }
+        area = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->fd, 0);
+        break;
+    default: { // BACKEND_NUMA, bind before the first touch
+        unsigned long mask[16];
+
+        area = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | huge_flags, -1, 0);
+        if (area == MAP_FAILED)
+            break;
+        if (!b->page_size)
+            madvise(area, b->size, MADV_HUGEPAGE);
+        memset(mask, 0, sizeof(mask));
+        if (b->node < 0 || b->node >= (int)(sizeof(mask) * 8)) {
+            fprintf(stderr, "Invalid NUMA node %d\n", b->node);
+            exit(1);
+        }
+        mask[b->node / 64] = 1UL << (b->node % 64);
+        if (syscall(SYS_mbind, area, b->size, MPOL_BIND, mask, sizeof(mask) * 8, MPOL_MF_STRICT) != 0) {
+            perror("mbind");
+            exit(1);
+        }
+        memset(area, 0, b->size);
+        break;
+    }
+    }
+    if (area == MAP_FAILED) {
+        perror(b->spec);
+        exit(1);
+    }
+    if (b->type == BACKEND_FPGAMEM) { // Touch and do the actual mapping of the test area, 1GB pages
+        uint64_t o;
+
+        for (o = 0; o < b->used; o += 1UL << 30)
+            ((uint8_t *)area)[o] = 0;
+    }
+    backend = b;
+    area_name = use_cpu_memory ? b->spec : "FPGA";
+    printf("Memory: %s\n", b->spec);
+}
+
+void unmap_backend(struct backend *b)
+{
+    munmap(area, b->size);
+    if (b->fd >= 0)
+        close(b->fd);
+    b->fd = -1;
+    area = NULL;
+    backend = NULL;
+}
+
+// Prefetching of the read kernel, two prefetch streams ahead of the reads:
+// a near one (L1 by default) and a far one (L2 by default), distances in cache lines
+// The configuration is chosen by the size of the area from a profile, see -T and -F
+#define PF_OP_NONE      0
+#define PF_OP_L1KEEP    1
+#define PF_OP_L1STRM    2
+#define PF_OP_L2KEEP    3
+#define PF_OP_L2STRM    4
+#define PF_OP_L3KEEP    5
+#define PF_OP_L3STRM    6
+#define PF_OPS          7
+
+const char *prefetch_op_names[PF_OPS] = {"none", "pldl1keep", "pldl1strm", "pldl2keep", "pldl2strm", "pldl3keep", "pldl3strm"};
+
+#define PF_NONE(p)
+#ifdef __aarch64__
+#define PF_L1KEEP(p) asm volatile("prfm pldl1keep, [%0]" : : "r" (p))
+#define PF_L1STRM(p) asm volatile("prfm pldl1strm, [%0]" : : "r" (p))
+#define PF_L2KEEP(p) asm volatile("prfm pldl2keep, [%0]" : : "r" (p))
+#define PF_L2STRM(p) asm volatile("prfm pldl2strm, [%0]" : : "r" (p))
+#define PF_L3KEEP(p) asm volatile("prfm pldl3keep, [%0]" : : "r" (p))
+#define PF_L3STRM(p) asm volatile("prfm pldl3strm, [%0]" : : "r" (p))
+#else // no streaming hints except for L1, nta
+#define PF_L1KEEP(p) __builtin_prefetch((p), 0, 3)
+#define PF_L1STRM(p) __builtin_prefetch((p), 0, 0)
+#define PF_L2KEEP(p) __builtin_prefetch((p), 0, 2)
+#define PF_L2STRM(p) __builtin_prefetch((p), 0, 2)
+#define PF_L3KEEP(p) __builtin_prefetch((p), 0, 1)
+#define PF_L3STRM(p) __builtin_prefetch((p), 0, 1)
+#endif
+
+struct prefetch_config {
+    uint64_t size;          // used for areas up to this size
+    unsigned near_op, near_dist;
+    unsigned far_op, far_dist;
+};
+
+#define MAX_PREFETCH_CONFIGS 64
+
+struct prefetch_profile {
+    char backend[256];      // backend spec, as given with -M
+    unsigned n;
+    struct prefetch_config c[MAX_PREFETCH_CONFIGS];
+};
+
+struct prefetch_profile prefetch_profiles[MAX_BACKENDS];
+unsigned no_prefetch_profiles;
+struct prefetch_config prefetch_forced; // used while tuning
+int prefetch_tuning;
+
+// Find the prefetch configuration for the area size and the backend
+struct prefetch_config prefetch_for(uint64_t size)
+{
+    struct prefetch_config pf = {0, PF_OP_NONE, 0, PF_OP_NONE, 0};
+    unsigned i, j;
+
+    if (prefetch_tuning)
+        return prefetch_forced;
+    for (i = 0; i < no_prefetch_profiles; i++) {
+        struct prefetch_profile *p = prefetch_profiles + i;
+
+        if (!backend || strcmp(p->backend, backend->spec) || p->n == 0)
+            continue;
+        for (j = 0; j < p->n - 1 && p->c[j].size < size; j++)
+            ;
+        return p->c[j];
+    }
+    // the default, nothing for L1, L1 prefetch for L2, L1 and L2 prefetch above that
+    if (size > l1_cache_size) {
+        pf.near_op = PF_OP_L1KEEP;
+        pf.near_dist = 4;
+    }
+    if (size > l2_cache_size) {
+        pf.far_op = PF_OP_L2KEEP;
+        pf.far_dist = 64;
+    }
+    return pf;
+}
+
+unsigned prefetch_op(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < PF_OPS; i++) {
+        if (!strcmp(name, prefetch_op_names[i]))
+            return i;
+    }
+    fprintf(stderr, "Unknown prefetch operation: %s\n", name);
+    exit(1);
+}
+
+// Load a profile written by -T:
+// backend <spec>
+// size <bytes> near <op> <distance> far <op> <distance>
+void load_prefetch_profile(const char *path)
+{
+    struct prefetch_profile *p = NULL;
+    char line[512], spec[256], near[16], far[16];
+    struct prefetch_config c;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "backend %255s", spec) == 1) {
+            if (no_prefetch_profiles == MAX_BACKENDS)
+                break;
+            p = prefetch_profiles + no_prefetch_profiles++;
+            snprintf(p->backend, sizeof(p->backend), "%s", spec);
+            p->n = 0;
+        } else if (sscanf(line, "size %ld near %15s %u far %15s %u", &c.size, near, &c.near_dist, far, &c.far_dist) == 5) {
+            if (!p || p->n == MAX_PREFETCH_CONFIGS)
+                continue;
+            c.near_op = prefetch_op(near);
+            c.far_op = prefetch_op(far);
+            p->c[p->n++] = c;
+        }
+    }
+    fclose(f);
+}
+
+// Hardware performance counters, one group per worker, read around the measured loops
+#define PERF_EVENTS 7
+
+const char *perf_event_names[PERF_EVENTS] = {"cycles", "instr", "l1d_refill", "l2_refill", "tlb_refill", "stall", "bus"};
+
+struct perf_event_config {
+    uint32_t type;
+    uint64_t config;
+};
+
+const struct perf_event_config perf_events[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+#ifdef __aarch64__
+    {PERF_TYPE_RAW, 0x17}, // L2D_CACHE_REFILL
+#else
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+#endif
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+#ifdef __aarch64__
+    {PERF_TYPE_RAW, 0x19}, // BUS_ACCESS
+#else
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES},
+#endif
+};
+
+// Persistent worker pool, one thread pinned to every selected core
+// The workers wait on pool_barrier for a function, run it, and wait on pool_barrier again
+struct worker {
+    pthread_t tid;
+    uint64_t result;
+    int perf_fd[PERF_EVENTS];       // -1 if the event is not supported
+    uint64_t counts[PERF_EVENTS];   // counts of the fastest run
+    int counts_valid;
+};
+
+// The slot after the workers counts on a thread outside the pool, the latency and c2c tests
+#define SELF_WORKER CPU_SETSIZE
+
+struct worker workers[CPU_SETSIZE + 1];
+pthread_barrier_t pool_barrier;
+void * (*pool_func)(void *);
+uint64_t pool_active;
+uint64_t pool_map[CPU_SETSIZE];     // worker running the n-th thread of the run
+int64_t pool_index[CPU_SETSIZE];    // index in the run of the worker, -1 if idle
+
+// Open the counter group of the calling worker, cycles are the group leader
+void perf_open(uint64_t me)
+{
+    struct perf_event_attr pe;
+    int i, leader;
+
+    leader = -1;
+    for (i = 0; i < PERF_EVENTS; i++) {
+        memset(&pe, 0, sizeof(pe));
+        pe.size = sizeof(pe);
+        pe.type = perf_events[i].type;
+        pe.config = perf_events[i].config;
+        pe.disabled = leader == -1;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        workers[me].perf_fd[i] = syscall(__NR_perf_event_open, &pe, 0, -1, leader, 0);
+        if (i == 0 && workers[me].perf_fd[0] < 0) {
+            fprintf(stderr, "perf_event_open failed on worker %ld, no counters.\n", me);
+            for (i = 1; i < PERF_EVENTS; i++)
+                workers[me].perf_fd[i] = -1;
+            return;
+        }
+        if (i == 0)
+            leader = workers[me].perf_fd[0];
+    }
+}
+
+void perf_close(uint64_t me)
+{
+    int i;
+
+    for (i = PERF_EVENTS - 1; i >= 0; i--) {
+        if (workers[me].perf_fd[i] >= 0)
+            close(workers[me].perf_fd[i]);
+    }
+}
+
+static __inline__ void perf_start_worker(struct worker *w)
+{
+    if (do_perf && w->perf_fd[0] >= 0) {
+        ioctl(w->perf_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(w->perf_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+// Stop the counters, keep the counts only if it was the fastest run
+static __inline__ void perf_stop_worker(struct worker *w, int keep)
+{
+    uint64_t buf[3 + PERF_EVENTS];
+    int i, n;
+
+    if (!do_perf || w->perf_fd[0] < 0)
+        return;
+    ioctl(w->perf_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (!keep)
+        return;
+    w->counts_valid = 0;
+    if (read(w->perf_fd[0], buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t)) || buf[2] == 0)
+        return; // the group was never scheduled
+    // values come in the order of the opened events, scaled if multiplexed
+    n = 0;
+    for (i = 0; i < PERF_EVENTS; i++) {
+        if (w->perf_fd[i] < 0)
+            continue;
+        w->counts[i] = (uint64_t)((double)buf[3 + n] * buf[1] / buf[2]);
+        n++;
+    }
+    w->counts_valid = 1;
+}
+
+// me is the index in the run, the counters are of the worker running it
+static __inline__ void perf_start(uint64_t me)
+{
+    perf_start_worker(workers + pool_map[me]);
+}
+
+static __inline__ void perf_stop(uint64_t me, int keep)
+{
+    perf_stop_worker(workers + pool_map[me], keep);
+}
+
+// Counters of the calling thread, in the SELF_WORKER slot, the same start/stop as the pool
+void perf_self_open(void)
+{
+    static int failed; // report it once, not at every test
+
+    workers[SELF_WORKER].counts_valid = 0;
+    if (do_perf && !failed) {
+        perf_open(SELF_WORKER);
+        failed = workers[SELF_WORKER].perf_fd[0] < 0;
+    }
+}
+
+void perf_self_close(void)
+{
+    if (do_perf && workers[SELF_WORKER].perf_fd[0] >= 0)
+        perf_close(SELF_WORKER);
+}
+
+static __inline__ void perf_self_start(void)
+{
+    perf_start_worker(workers + SELF_WORKER);
+}
+
+static __inline__ void perf_self_stop(int keep)
+{
+    perf_stop_worker(workers + SELF_WORKER, keep);
+}
+
+// Print counts, the events not opened on the worker as n/a
+void print_counts(const uint64_t *sum, const struct worker *opened)
+{
+    uint64_t j;
+
+    printf("[");
+    for (j = 0; j < PERF_EVENTS; j++) {
+        if (opened->perf_fd[j] < 0)
+            printf("%s n/a ", perf_event_names[j]);
+        else
+            printf("%s %.4g ", perf_event_names[j], (double)sum[j]);
+    }
+    printf("ipc %.2f]\t", sum[0] ? (double)sum[1] / sum[0] : 0.0);
+}
+
+// Print the counters summed over the workers of the last run of n threads
+void print_counters(uint64_t n)
+{
+    uint64_t sum[PERF_EVENTS];
+    uint64_t i, j;
+
+    if (!do_perf || workers[0].perf_fd[0] < 0)
+        return;
+    memset(sum, 0, sizeof(sum));
+    for (i = 0; i < n; i++) {
+        struct worker *w = workers + pool_map[i];
+
+        if (!w->counts_valid)
+            continue;
+        for (j = 0; j < PERF_EVENTS; j++)
+            sum[j] += w->counts[j];
+    }
+    print_counts(sum, workers);
+}
+
+// Print the counters of the fastest run on the calling thread
+void print_self_counters(void)
+{
+    if (!do_perf || !workers[SELF_WORKER].counts_valid)
+        return;
+    print_counts(workers[SELF_WORKER].counts, workers + SELF_WORKER);
+}
+
+void * pool_worker(void *v)
+{
+    uint64_t me = (uint64_t)v;
+    int64_t index;
+
+    if (do_perf)
+        perf_open(me);
+    for (;;) {
+        pthread_barrier_wait(&pool_barrier);
+        if (!pool_func)
+            break;
+        index = pool_index[me];
+        if (index >= 0)
+            workers[index].result = (uint64_t)pool_func((void *)index);
+        pthread_barrier_wait(&pool_barrier);
+    }
+    if (do_perf)
+        perf_close(me);
+    return NULL;
+}
+
+void start_pool(void)
 {
-    pthread_t tids[128];
     pthread_attr_t attr;
     cpu_set_t cpus;
-    uint64_t i, min, retval;
+    uint64_t i;
 
-    min = UINT64_MAX;
-    pthread_barrier_init(&barrier, NULL, last_cpu - first_cpu + 2);
-    for (i = first_cpu; i <= last_cpu; i++) {
+    pool_func = NULL;
+    for (i = 0; i < no_threads; i++)
+        pool_map[i] = i;
+    pthread_barrier_init(&pool_barrier, NULL, no_threads + 1);
+    for (i = 0; i < no_threads; i++) {
         pthread_attr_init(&attr);
         CPU_ZERO(&cpus);
-        CPU_SET(i, &cpus);
+        CPU_SET(cpu_list[i], &cpus);
         pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
-        pthread_create(tids + i, &attr, thread_func, (void *)i);
+        assert(pthread_create(&workers[i].tid, &attr, pool_worker, (void *)i) == 0);
         pthread_attr_destroy(&attr);
     }
-    pthread_barrier_wait(&barrier);
-    for (i = 0; i < 3; i++) {
-        pthread_barrier_wait(&barrier);
+}
+
+void stop_pool(void)
+{
+    uint64_t i;
+
+    pool_func = NULL;
+    pthread_barrier_wait(&pool_barrier);
+    for (i = 0; i < no_threads; i++)
+        pthread_join(workers[i].tid, NULL);
+    pthread_barrier_destroy(&pool_barrier);
+}
+
+// Run a thread function on the workers of the map and collect the results
+// The function gets its index in the map, the results are in workers[] by that index
+uint64_t start_threads_on(uint64_t n, const uint64_t *map, void * (*thread_func)(void *))
+{
+    uint64_t i, sum;
+
+    assert(n >= 1 && n <= no_threads);
+    for (i = 0; i < no_threads; i++)
+        pool_index[i] = -1;
+    for (i = 0; i < n; i++) {
+        pool_map[i] = map[i];
+        pool_index[map[i]] = i;
     }
-    min = 0;
-    for (i = first_cpu; i <= last_cpu; i++) {
-        pthread_join(tids[i], (void *)&retval);
-        min += retval;
+    pthread_barrier_init(&barrier, NULL, n + 1);
+    pool_active = n;
+    pool_func = thread_func;
+    pthread_barrier_wait(&pool_barrier);
+    for (i = 0; i < 4; i++) {
+        pthread_barrier_wait(&barrier);
     }
+    pthread_barrier_wait(&pool_barrier);
+    sum = 0;
+    for (i = 0; i < n; i++)
+        sum += workers[i].result;
     pthread_barrier_destroy(&barrier);
-    return min / (last_cpu - first_cpu + 1);
+    return sum / n;
+}
+
+// Run a thread function on the first n workers
+uint64_t start_threads(uint64_t n, void * (*thread_func)(void *))
+{
+    uint64_t map[CPU_SETSIZE];
+    uint64_t i;
+
+    for (i = 0; i < n; i++)
+        map[i] = i;
+    return start_threads_on(n, map, thread_func);
+}
+
+// Parse a list of cores like "0-7,16,32-47"
+unsigned parse_cpu_list(const char *text, unsigned *list)
+{
+    const char *p = text;
+    char *end;
+    unsigned long a, b, n;
+
+    n = 0;
+    while (*p) {
+        a = strtoul(p, &end, 10);
+        if (end == p)
+            break;
+        b = a;
+        p = end;
+        if (*p == '-') {
+            p++;
+            b = strtoul(p, &end, 10);
+            if (end == p)
+                break;
+            p = end;
+        }
+        if (b >= (unsigned long)get_nprocs_conf()) {
+            fprintf(stderr, "No core %ld\n", b);
+            exit(1);
+        }
+        for (; a <= b && n < CPU_SETSIZE; a++)
+            list[n++] = a;
+        if (*p != ',')
+            break;
+        p++;
+    }
+    if (*p || n == 0) {
+        fprintf(stderr, "Invalid core list: %s\n", text);
+        exit(1);
+    }
+    return n;
+}
+
+// Read the first line of a sysfs file, 0 if missing
+int read_sysfs(char *buf, size_t len, const char *fmt, unsigned cpu, unsigned index)
+{
+    char path[128];
+    FILE *f;
+
+    snprintf(path, sizeof(path), fmt, cpu, index);
+    f = fopen(path, "r");
+    if (!f)
+        return 0;
+    if (!fgets(buf, len, f))
+        buf[0] = 0;
+    fclose(f);
+    buf[strcspn(buf, "\n")] = 0;
+    return buf[0] != 0;
+}
+
+// Find the line and DC ZVA sizes and the counter frequency from the system registers,
+// the caches of the first selected core and the cores sharing them from sysfs
+void detect_topology(void)
+{
+    static unsigned shared[CPU_SETSIZE];
+    char buf[256];
+    unsigned i, j, n, level, cpu = cpu_list[0];
+    uint64_t size;
+
+#ifdef __aarch64__
+    uint64_t ctr, dczid;
+
+    asm volatile("mrs %0, ctr_el0" : "=r" (ctr));
+    asm volatile("mrs %0, dczid_el0" : "=r" (dczid));
+    asm volatile("mrs %0, cntfrq_el0" : "=r" (counter_freq));
+    line_size = 4UL << ((ctr >> 16) & 0xf);     // DminLine, log2 of words
+    zva_size = dczid & 0x10 ? 0 : 4UL << (dczid & 0xf);
+#endif
+    level = 0;
+    for (i = 0; read_sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/cache/index%u/type", cpu, i); i++) {
+        if (!strcmp(buf, "Instruction"))
+            continue;
+        if (!read_sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/cache/index%u/size", cpu, i))
+            continue;
+        size = parse_size(buf);
+        if (!read_sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", cpu, i))
+            continue;
+        j = atoi(buf);
+        if (j == 1) {
+            l1_cache_size = size;
+#ifndef __aarch64__
+            if (read_sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/cache/index%u/coherency_line_size", cpu, i))
+                line_size = atoi(buf);
+#endif
+        }
+        if (j >= level) {
+            level = j;
+            llc_level = j;
+            llc_size = size;
+            CPU_ZERO(&llc_cpus);
+            if (read_sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", cpu, i))
+                for (n = parse_cpu_list(buf, shared); n > 0; n--)
+                    CPU_SET(shared[n - 1], &llc_cpus);
+        }
+    }
+    if (!level) // no sysfs, all the cores share the L2 as on ThunderX
+        for (i = 0; i < (unsigned)get_nprocs_conf(); i++)
+            CPU_SET(i, &llc_cpus);
+    if (read_sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/cpufreq/cpuinfo_max_freq", cpu, 0))
+        cpu_ghz = atof(buf) / 1000000.0; // in kHz
+}
+
+// First and last size exponent of a sweep, def is the default last one
+unsigned sweep_first(void)
+{
+    return 63 - (unsigned)__builtin_clzl(sweep_min);
+}
+
+unsigned sweep_last(unsigned def)
+{
+    return sweep_max ? 63 - (unsigned)__builtin_clzl(sweep_max) : def;
+}
+
+// Thread counts for the sweeps: 1, 2, 4, ... and always the last one
+uint64_t next_thread_count(uint64_t n, uint64_t max)
+{
+    if (n == max)
+        return max + 1;
+    return n * 2 < max ? n * 2 : max;
 }
 
 void * thread_write_cache_area(void *v)
@@ -175,6 +965,7 @@ void * thread_write_cache_area(void *v)
 
     for (k = 0; k < 4; k++) {
         pthread_barrier_wait(&barrier);
+        perf_start(me);
         cycles = now();
         for (j = 0; j < itn; j++) {
             for (d = a; d < e; d++) {
@@ -190,6 +981,7 @@ void * thread_write_cache_area(void *v)
             }
         }
         cycles = now() - cycles;
+        perf_stop(me, cycles < min);
         if (cycles < min)
             min = cycles;
     }
@@ -201,7 +993,7 @@ void * thread_clear_cache_area(void *v)
     uint64_t min, cycles;
     uint64_t me = (uint64_t)v;
     uint64_t j, k;
-    cacheline_float_t *a, *d, *e;
+    uint8_t *a, *d, *e;
 
     a = area + (me * area_test_size);
     e = area + (me * area_test_size) + area_test_size;
@@ -209,19 +1001,53 @@ void * thread_clear_cache_area(void *v)
 
     for (k = 0; k < 4; k++) {
         pthread_barrier_wait(&barrier);
+        perf_start(me);
         cycles = now();
         for (j = 0; j < itn; j++) {
-            for (d = a; d < e; d++) {
-                asm("dc zva, %0" : : "r" (d) : "memory");
+            if (zva_size) {
+                for (d = a; d < e; d += zva_size)
+                    zero_line(d);
+            } else { // DC ZVA prohibited
+                memset(a, 0, e - a);
             }
+            nt_fence();
         }
         cycles = now() - cycles;
+        perf_stop(me, cycles < min);
         if (cycles < min)
             min = cycles;
     }
     return (void *)min;
 }
 
+#define READ_LOOP(PF_NEAR, PF_FAR) \
+    for (j = 0; j < itn; j++) { \
+        for (s = a; s < e; s++) { \
+            PF_NEAR(s + pf.near_dist); \
+            PF_FAR(s + pf.far_dist); \
+            tab[0] = s[0][0]; \
+            tab[1] = s[0][1]; \
+            tab[2] = s[0][2]; \
+            tab[3] = s[0][3]; \
+            tab[4] = s[0][4]; \
+            tab[5] = s[0][5]; \
+            tab[6] = s[0][6]; \
+            tab[7] = s[0][7]; \
+            asm("" : : VEC_REG (tab[0]), VEC_REG (tab[1]), VEC_REG (tab[2]), VEC_REG (tab[3]), VEC_REG (tab[4]), VEC_REG (tab[5]), VEC_REG (tab[6]), VEC_REG (tab[7])); \
+        } \
+    }
+
+#define READ_LOOP_FAR(PF_NEAR) \
+    switch (pf.far_op) { \
+    case PF_OP_NONE: READ_LOOP(PF_NEAR, PF_NONE); break; \
+    case PF_OP_L1KEEP: READ_LOOP(PF_NEAR, PF_L1KEEP); break; \
+    case PF_OP_L1STRM: READ_LOOP(PF_NEAR, PF_L1STRM); break; \
+    case PF_OP_L2KEEP: READ_LOOP(PF_NEAR, PF_L2KEEP); break; \
+    case PF_OP_L2STRM: READ_LOOP(PF_NEAR, PF_L2STRM); break; \
+    case PF_OP_L3KEEP: READ_LOOP(PF_NEAR, PF_L3KEEP); break; \
+    default: READ_LOOP(PF_NEAR, PF_L3STRM); break; \
+    }
+
 void * thread_read_cache_area(void *v)
 {
     uint64_t min, cycles;
@@ -229,92 +1055,370 @@ void * thread_read_cache_area(void *v)
     uint64_t j, k;
     cacheline_float_t *a, *s, *e;
     cacheline_float_t tab;
+    struct prefetch_config pf;
 
     a = area + (me * area_test_size);
     e = area + (me * area_test_size) + area_test_size;
+    pf = prefetch_for(area_test_size);
     min = UINT64_MAX;
 
     for (k = 0; k < 4; k++) {
         pthread_barrier_wait(&barrier);
+        perf_start(me);
         cycles = now();
-        if (area_test_size <= 32768) {
-            for (j = 0; j < itn; j++) {
-                for (s = a; s < e; s++) {
-                    tab[0] = s[0][0];
-                    tab[1] = s[0][1];
-                    tab[2] = s[0][2];
-                    tab[3] = s[0][3];
-                    tab[4] = s[0][4];
-                    tab[5] = s[0][5];
-                    tab[6] = s[0][6];
-                    tab[7] = s[0][7];
-                    asm("" : : "w" (tab[0]), "w" (tab[1]), "w" (tab[2]), "w" (tab[3]), "w" (tab[4]), "w" (tab[5]), "w" (tab[6]), "w" (tab[7]));
-                }
-            }
-        } else if (area_test_size <= l2_cache_size) {
-            for (j = 0; j < itn; j++) {
-                for (s = a; s < e; s++) {
-                    __builtin_prefetch(s + 4, 0, 3); // L1 prefetch
-                    tab[0] = s[0][0];
-                    tab[1] = s[0][1];
-                    tab[2] = s[0][2];
-                    tab[3] = s[0][3];
-                    tab[4] = s[0][4];
-                    tab[5] = s[0][5];
-                    tab[6] = s[0][6];
-                    tab[7] = s[0][7];
-                    asm("" : : "w" (tab[0]), "w" (tab[1]), "w" (tab[2]), "w" (tab[3]), "w" (tab[4]), "w" (tab[5]), "w" (tab[6]), "w" (tab[7]));
-                }
-            }
-        } else {
-            for (j = 0; j < itn; j++) {
-                for (s = a; s < e; s++) {
-                    __builtin_prefetch(s + 4, 0, 3); // L1 prefetch
-                    __builtin_prefetch(s + 64, 0, 2); // L2 prefetch
-                    tab[0] = s[0][0];
-                    tab[1] = s[0][1];
-                    tab[2] = s[0][2];
-                    tab[3] = s[0][3];
-                    tab[4] = s[0][4];
-                    tab[5] = s[0][5];
-                    tab[6] = s[0][6];
-                    tab[7] = s[0][7];
-                    asm("" : : "w" (tab[0]), "w" (tab[1]), "w" (tab[2]), "w" (tab[3]), "w" (tab[4]), "w" (tab[5]), "w" (tab[6]), "w" (tab[7]));
-                }
-            }
+        switch (pf.near_op) {
+        case PF_OP_NONE: READ_LOOP_FAR(PF_NONE); break;
+        case PF_OP_L1KEEP: READ_LOOP_FAR(PF_L1KEEP); break;
+        case PF_OP_L1STRM: READ_LOOP_FAR(PF_L1STRM); break;
+        case PF_OP_L2KEEP: READ_LOOP_FAR(PF_L2KEEP); break;
+        case PF_OP_L2STRM: READ_LOOP_FAR(PF_L2STRM); break;
+        case PF_OP_L3KEEP: READ_LOOP_FAR(PF_L3KEEP); break;
+        default: READ_LOOP_FAR(PF_L3STRM); break;
         }
         cycles = now() - cycles;
+        perf_stop(me, cycles < min);
         if (cycles < min)
             min = cycles;
     }
     return (void *)min;
 }
 
-// Do the pointer chasing latency
-void do_latency_test(unsigned int size)
-{
-    uint64_t i, l, o, p;
-    double t;
-    uint64_t cycle, base, diff, avg, min;
-    volatile cacheline_uint64_t *c;
-    uint64_t ITS;
-
-    l = (1 << size) / CACHELINE_SIZE; // number of cache lines
-    ITS = size < 12 ? 1 << (12 - size) : 1;
-    if (ITS == 0)
-        ITS = 1;
+// Read/write mix, mix_reads lines are read, then mix_writes lines are written, and so on
+unsigned mix_reads = 1, mix_writes = 1;
 
-    c = (cacheline_uint64_t *)area;
+void * thread_mix_cache_area(void *v)
+{
+    uint64_t min, cycles;
+    uint64_t me = (uint64_t)v;
+    uint64_t j, k;
+    unsigned c, period;
+    cacheline_float_t *a, *d, *e;
+    cacheline_float_t tab;
+    v4f one = {1.0, 2.0, 3.0, 4.0};
 
-// find base latency
+    a = area + (me * area_test_size);
+    e = area + (me * area_test_size) + area_test_size;
+    period = mix_reads + mix_writes;
+    for (c = 0; c < 8; c++)
+        tab[c] = one;
     min = UINT64_MAX;
-    for (p = 0; p < 5; p++) {
-        cycle = now();
-        o = 0;
-        for (i = 0; i < ITS * l / 8; i++) {
-            asm("nop");
-            asm("nop");
-            asm("nop");
+
+    for (k = 0; k < 4; k++) {
+        pthread_barrier_wait(&barrier);
+        perf_start(me);
+        cycles = now();
+        for (j = 0; j < itn; j++) {
+            c = 0;
+            for (d = a; d < e; d++) {
+                if (c < mix_reads) {
+                    tab[0] = d[0][0];
+                    tab[1] = d[0][1];
+                    tab[2] = d[0][2];
+                    tab[3] = d[0][3];
+                    tab[4] = d[0][4];
+                    tab[5] = d[0][5];
+                    tab[6] = d[0][6];
+                    tab[7] = d[0][7];
+                    asm("" : : VEC_REG (tab[0]), VEC_REG (tab[1]), VEC_REG (tab[2]), VEC_REG (tab[3]), VEC_REG (tab[4]), VEC_REG (tab[5]), VEC_REG (tab[6]), VEC_REG (tab[7]));
+                } else {
+                    d[0][0] = tab[0];
+                    d[0][1] = tab[1];
+                    d[0][2] = tab[2];
+                    d[0][3] = tab[3];
+                    d[0][4] = tab[4];
+                    d[0][5] = tab[5];
+                    d[0][6] = tab[6];
+                    d[0][7] = tab[7];
+                    asm("" : : "r" (d) : "memory");
+                }
+                if (++c == period)
+                    c = 0;
+            }
+        }
+        cycles = now() - cycles;
+        perf_stop(me, cycles < min);
+        if (cycles < min)
+            min = cycles;
+    }
+    return (void *)min;
+}
+
+// Read-modify-write of every line
+void * thread_rmw_cache_area(void *v)
+{
+    uint64_t min, cycles;
+    uint64_t me = (uint64_t)v;
+    uint64_t j, k;
+    cacheline_float_t *a, *d, *e;
+    v4f one = {1.0, 1.0, 1.0, 1.0};
+
+    a = area + (me * area_test_size);
+    e = area + (me * area_test_size) + area_test_size;
+    min = UINT64_MAX;
+
+    for (k = 0; k < 4; k++) {
+        pthread_barrier_wait(&barrier);
+        perf_start(me);
+        cycles = now();
+        for (j = 0; j < itn; j++) {
+            for (d = a; d < e; d++) {
+                d[0][0] += one;
+                d[0][1] += one;
+                d[0][2] += one;
+                d[0][3] += one;
+                d[0][4] += one;
+                d[0][5] += one;
+                d[0][6] += one;
+                d[0][7] += one;
+                asm("" : : "r" (d) : "memory");
+            }
+        }
+        cycles = now() - cycles;
+        perf_stop(me, cycles < min);
+        if (cycles < min)
+            min = cycles;
+    }
+    return (void *)min;
+}
+
+// Atomic increments of counters in shared cache lines, worker me uses the line me % atomic_lines
+#define ATOMIC_LDADD    0 // LSE far atomic, lock xadd on x86
+#define ATOMIC_CAS      1 // compare and swap loop
+#define ATOMIC_LLSC     2 // LDXR/STXR loop
+#define ATOMIC_KINDS    3
+#define ATOMIC_OPS      100000
+
+const char *atomic_kind_names[ATOMIC_KINDS] = {"ldadd", "cas", "ldxr/stxr"};
+unsigned atomic_kind, atomic_lines = 1;
+
+// Check if the CPU can do the atomic kind
+int atomic_supported(unsigned kind)
+{
+#ifdef __aarch64__
+    if (kind == ATOMIC_LDADD)
+        return (getauxval(AT_HWCAP) & HWCAP_ATOMICS) != 0;
+    return 1;
+#else
+    return kind != ATOMIC_LLSC;
+#endif
+}
+
+static __inline__ void atomic_inc(volatile uint64_t *p, unsigned kind)
+{
+    uint64_t v, n;
+
+    switch (kind) {
+    case ATOMIC_LDADD:
+#ifdef __aarch64__
+        asm volatile(".arch_extension lse\nldadd %1, %0, [%2]" : "=&r" (v) : "r" (1UL), "r" (p) : "memory");
+#else
+        __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);
+#endif
+        break;
+    case ATOMIC_CAS:
+        v = *p;
+        do {
+            n = v + 1;
+        } while (!__atomic_compare_exchange_n(p, &v, n, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+        break;
+    default: // ATOMIC_LLSC
+#ifdef __aarch64__
+        {
+            uint32_t fail;
+
+            asm volatile(
+                "1: ldxr %0, [%2]\n"
+                "add %0, %0, #1\n"
+                "stxr %w1, %0, [%2]\n"
+                "cbnz %w1, 1b\n"
+                : "=&r" (v), "=&r" (fail) : "r" (p) : "memory");
+        }
+#endif
+        break;
+    }
+}
+
+void * thread_atomic(void *v)
+{
+    uint64_t min, cycles;
+    uint64_t me = (uint64_t)v;
+    uint64_t j, k;
+    volatile uint64_t *p;
+
+    p = area + (me % atomic_lines) * CACHELINE_SIZE;
+    min = UINT64_MAX;
+
+    for (k = 0; k < 4; k++) {
+        pthread_barrier_wait(&barrier);
+        perf_start(me);
+        cycles = now();
+        for (j = 0; j < itn * ATOMIC_OPS; j++)
+            atomic_inc(p, atomic_kind);
+        cycles = now() - cycles;
+        perf_stop(me, cycles < min);
+        if (cycles < min)
+            min = cycles;
+    }
+    return (void *)min;
+}
+
+// Copy kernels, one cache line per step
+#define COPY_MEMCPY     0 // libc memcpy
+#define COPY_LDP_STP    1 // NEON LDP/STP of 8 q registers
+#define COPY_LDNP_STNP  2 // non-temporal LDNP/STNP
+#define COPY_ZVA_STP    3 // dc zva on the destination line, then LDP/STP (non-temporal zeroing on x86)
+#define COPY_KERNELS    4
+
+const char *copy_kernel_names[COPY_KERNELS] = {"memcpy", "ldp/stp", "ldnp/stnp", "zva+stp"};
+
+static __inline__ void copy_line_ldp_stp(void *d, const void *s)
+{
+#ifdef __aarch64__
+    asm volatile(
+        "ldp q0, q1, [%1]\n"
+        "ldp q2, q3, [%1, #32]\n"
+        "ldp q4, q5, [%1, #64]\n"
+        "ldp q6, q7, [%1, #96]\n"
+        "stp q0, q1, [%0]\n"
+        "stp q2, q3, [%0, #32]\n"
+        "stp q4, q5, [%0, #64]\n"
+        "stp q6, q7, [%0, #96]\n"
+        :: "r" (d), "r" (s) : "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "memory");
+#endif
+#ifdef __amd64__
+    __m128i r0, r1, r2, r3, r4, r5, r6, r7;
+
+    r0 = _mm_load_si128((const __m128i *)s + 0);
+    r1 = _mm_load_si128((const __m128i *)s + 1);
+    r2 = _mm_load_si128((const __m128i *)s + 2);
+    r3 = _mm_load_si128((const __m128i *)s + 3);
+    r4 = _mm_load_si128((const __m128i *)s + 4);
+    r5 = _mm_load_si128((const __m128i *)s + 5);
+    r6 = _mm_load_si128((const __m128i *)s + 6);
+    r7 = _mm_load_si128((const __m128i *)s + 7);
+    _mm_store_si128((__m128i *)d + 0, r0);
+    _mm_store_si128((__m128i *)d + 1, r1);
+    _mm_store_si128((__m128i *)d + 2, r2);
+    _mm_store_si128((__m128i *)d + 3, r3);
+    _mm_store_si128((__m128i *)d + 4, r4);
+    _mm_store_si128((__m128i *)d + 5, r5);
+    _mm_store_si128((__m128i *)d + 6, r6);
+    _mm_store_si128((__m128i *)d + 7, r7);
+#endif
+}
+
+// x86 has no non-temporal loads from the write-back memory, only the stores are non-temporal
+static __inline__ void copy_line_ldnp_stnp(void *d, const void *s)
+{
+#ifdef __aarch64__
+    asm volatile(
+        "ldnp q0, q1, [%1]\n"
+        "ldnp q2, q3, [%1, #32]\n"
+        "ldnp q4, q5, [%1, #64]\n"
+        "ldnp q6, q7, [%1, #96]\n"
+        "stnp q0, q1, [%0]\n"
+        "stnp q2, q3, [%0, #32]\n"
+        "stnp q4, q5, [%0, #64]\n"
+        "stnp q6, q7, [%0, #96]\n"
+        :: "r" (d), "r" (s) : "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "memory");
+#endif
+#ifdef __amd64__
+    __m128i r0, r1, r2, r3, r4, r5, r6, r7;
+
+    r0 = _mm_load_si128((const __m128i *)s + 0);
+    r1 = _mm_load_si128((const __m128i *)s + 1);
+    r2 = _mm_load_si128((const __m128i *)s + 2);
+    r3 = _mm_load_si128((const __m128i *)s + 3);
+    r4 = _mm_load_si128((const __m128i *)s + 4);
+    r5 = _mm_load_si128((const __m128i *)s + 5);
+    r6 = _mm_load_si128((const __m128i *)s + 6);
+    r7 = _mm_load_si128((const __m128i *)s + 7);
+    _mm_stream_si128((__m128i *)d + 0, r0);
+    _mm_stream_si128((__m128i *)d + 1, r1);
+    _mm_stream_si128((__m128i *)d + 2, r2);
+    _mm_stream_si128((__m128i *)d + 3, r3);
+    _mm_stream_si128((__m128i *)d + 4, r4);
+    _mm_stream_si128((__m128i *)d + 5, r5);
+    _mm_stream_si128((__m128i *)d + 6, r6);
+    _mm_stream_si128((__m128i *)d + 7, r7);
+#endif
+}
+
+void * thread_copy_area(void *v)
+{
+    uint64_t min, cycles;
+    uint64_t me = (uint64_t)v;
+    uint64_t j, k;
+    cacheline_float_t *a, *b, *s, *d, *e;
+    uint8_t *z;
+
+    a = copy_src + (me * area_test_size);
+    e = copy_src + (me * area_test_size) + area_test_size;
+    b = copy_dst + (me * area_test_size);
+    min = UINT64_MAX;
+
+    for (k = 0; k < 4; k++) {
+        pthread_barrier_wait(&barrier);
+        perf_start(me);
+        cycles = now();
+        for (j = 0; j < itn; j++) {
+            switch (copy_kernel) {
+            case COPY_MEMCPY:
+                memcpy(b, a, area_test_size);
+                asm("" : : "r" (b) : "memory");
+                break;
+            case COPY_LDP_STP:
+                for (s = a, d = b; s < e; s++, d++)
+                    copy_line_ldp_stp(d, s);
+                break;
+            case COPY_LDNP_STNP:
+                for (s = a, d = b; s < e; s++, d++)
+                    copy_line_ldnp_stnp(d, s);
+                nt_fence();
+                break;
+            default: // COPY_ZVA_STP, zero every DC ZVA block before writing its first line
+                for (s = a, d = b; s < e; s++, d++) {
+                    for (z = (uint8_t *)d; zva_size && z < (uint8_t *)(d + 1); z += zva_size)
+                        if (!((uintptr_t)z & (zva_size - 1)))
+                            zero_line(z);
+                    copy_line_ldp_stp(d, s);
+                }
+                break;
+            }
+        }
+        cycles = now() - cycles;
+        perf_stop(me, cycles < min);
+        if (cycles < min)
+            min = cycles;
+    }
+    return (void *)min;
+}
+
+// Do the pointer chasing latency
+void do_latency_test(unsigned int size)
+{
+    uint64_t i, l, o, p;
+    double t;
+    uint64_t cycle, base, diff, avg, min;
+    volatile uint8_t *c;
+    uint64_t ITS;
+
+    l = (1UL << size) / line_size; // number of cache lines
+    ITS = size < 12 ? 1 << (12 - size) : 1;
+    if (ITS == 0)
+        ITS = 1;
+
+    c = area;
+
+// find base latency
+    min = UINT64_MAX;
+    for (p = 0; p < 5; p++) {
+        cycle = now();
+        o = 0;
+        for (i = 0; i < ITS * l / 8; i++) {
+            asm("nop");
+            asm("nop");
+            asm("nop");
             asm("nop");
             asm("nop");
             asm("nop");
@@ -327,53 +1431,60 @@ void do_latency_test(unsigned int size)
     }
     base = min;
 
-// fill the pointers using PRNG
+// fill the pointers using PRNG, as offsets of the lines
     o = 0;
     for (i = 0; i < ITS * l; i++) {
         uint64_t no = ((o * 13 + 7) & (l - 1));
-        c[o][0][0] = no;
+        *(volatile uint64_t *)(c + o * line_size) = no * line_size;
         o = no;
     }
 
 // do the chasing
+    perf_self_open();
     min = UINT64_MAX;
     for (p = 0; p < 5; p++) {
+        perf_self_start();
         cycle = now();
         o = 0;
         for (i = 0; i < ITS * l / 8; i++) {
-            o = c[o][0][0];
-            o = c[o][0][0];
-            o = c[o][0][0];
-            o = c[o][0][0];
-            o = c[o][0][0];
-            o = c[o][0][0];
-            o = c[o][0][0];
-            o = c[o][0][0];
+            o = *(volatile uint64_t *)(c + o);
+            o = *(volatile uint64_t *)(c + o);
+            o = *(volatile uint64_t *)(c + o);
+            o = *(volatile uint64_t *)(c + o);
+            o = *(volatile uint64_t *)(c + o);
+            o = *(volatile uint64_t *)(c + o);
+            o = *(volatile uint64_t *)(c + o);
+            o = *(volatile uint64_t *)(c + o);
             asm("":: "r" (o));
         }
         diff = now() - cycle;
+        perf_self_stop(p > 0 && diff < min);
         if (p > 0 && diff < min)
             min = diff;
     }
+    perf_self_close();
     avg = min;
     t = (double)(avg - base) / rate / (ITS * l);
-    printf("Size:%s  Latency:%4.1fns  Cycles:%ld\n", nice_size(1 << size), t, (uint64_t)(t * 2 + 0.5));
+    printf("Size:%s  Latency:%4.1fns  Cycles:%ld\t", nice_size(1UL << size), t, (uint64_t)(t * cpu_ghz + 0.5));
+    print_self_counters();
+    printf("\n");
 }
 
-// Do the sequential latency
-void do_seq_latency_test(unsigned int size)
+// Do the sequential latency, size 0 is one pass over 64MB for the stress test
+double do_seq_latency_test(unsigned int size)
 {
     uint64_t i, l, o, p;
     double t;
     uint64_t cycle, base, diff, avg, min;
-    volatile cacheline_uint64_t *c;
+    volatile uint64_t *c;
+    uint64_t w = line_size / 8; // words per line
 
     if (size) {
-        l = (1 << size) / CACHELINE_SIZE; // number of cache lines
+        l = (1UL << size) / line_size; // number of cache lines
     } else { // continuous test
-        l = (1 << 26) / CACHELINE_SIZE; // number of cache lines
+        l = (1 << 26) / line_size; // number of cache lines
     }
-    c = (cacheline_uint64_t *)area;
+    c = area;
 
 // find base latency
     min = UINT64_MAX;
@@ -394,119 +1505,1493 @@ void do_seq_latency_test(unsigned int size)
         if (p > 0 && diff < min)
             min = diff;
     }
-    base = min;
+    base = min;
+
+    perf_self_open();
+    min = UINT64_MAX;
+    for (p = 0; p < 5; p++) {
+        perf_self_start();
+        cycle = now();
+        o = 0;
+        for (i = 0; i < l; i += 8) {
+            o |= c[i * w];
+            o |= c[(i + 1) * w];
+            o |= c[(i + 2) * w];
+            o |= c[(i + 3) * w];
+            o |= c[(i + 4) * w];
+            o |= c[(i + 5) * w];
+            o |= c[(i + 6) * w];
+            o |= c[(i + 7) * w];
+            asm("":: "r" (o));
+        }
+        diff = now() - cycle;
+        perf_self_stop(p > 0 && diff < min);
+        if (p > 0 && diff < min)
+            min = diff;
+    }
+    perf_self_close();
+    avg = min;
+    t = (double)(avg - base) / rate / l;
+    printf("Size:%s  Latency:%4.1fns  Cycles:%ld\t", nice_size(l * line_size), t, (uint64_t)(t * cpu_ghz + 0.5));
+    print_self_counters();
+    printf("\n");
+    return t;
+}
+
+// Tune the prefetching of the read kernel for every area size
+// First the near stream alone, then the far stream with the best near one
+#define PF_TUNE_DISTS 6
+
+void do_prefetch_tuning(FILE *profile)
+{
+    static const unsigned near_dists[PF_TUNE_DISTS] = {1, 2, 4, 8, 16, 32};
+    static const unsigned far_dists[PF_TUNE_DISTS] = {16, 32, 64, 128, 256, 512};
+    struct prefetch_config best;
+    uint64_t i, s, best_s, default_s;
+    unsigned op, d, pass;
+
+    printf("Prefetch tuning, %d thread(s)\n", no_threads);
+    if (profile)
+        fprintf(profile, "backend %s\n", backend->spec);
+    for (i = sweep_first(); i <= sweep_last(25); i++) { // from 16kiB to 32MiB by default
+        area_test_size = 1UL << i;
+        itn = i > 22 ? 1: 1 << (22 - i);
+        default_s = start_threads(no_threads, thread_read_cache_area);
+
+        prefetch_tuning = 1;
+        memset(&best, 0, sizeof(best));
+        best.size = area_test_size;
+        prefetch_forced = best;
+        best_s = start_threads(no_threads, thread_read_cache_area);
+        for (pass = 0; pass < 2; pass++) {
+            struct prefetch_config base = best;
+
+            for (op = PF_OP_L1KEEP; op < PF_OPS; op++) {
+                for (d = 0; d < PF_TUNE_DISTS; d++) {
+                    prefetch_forced = base;
+                    if (pass == 0) {
+                        prefetch_forced.near_op = op;
+                        prefetch_forced.near_dist = near_dists[d];
+                    } else {
+                        prefetch_forced.far_op = op;
+                        prefetch_forced.far_dist = far_dists[d];
+                    }
+                    s = start_threads(no_threads, thread_read_cache_area);
+                    if (s < best_s) {
+                        best_s = s;
+                        best = prefetch_forced;
+                    }
+                }
+            }
+        }
+        prefetch_tuning = 0;
+
+        printf("Size: %s\tnear %s %d far %s %d\tread %.3fGB/s\tdefault %.3fGB/s\n", nice_size(area_test_size),
+            prefetch_op_names[best.near_op], best.near_dist, prefetch_op_names[best.far_op], best.far_dist,
+            (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / best_s / 1048576.0 / 1024.0,
+            (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / default_s / 1048576.0 / 1024.0);
+        fflush(stdout);
+        if (profile)
+            fprintf(profile, "size %ld near %s %d far %s %d\n", area_test_size,
+                prefetch_op_names[best.near_op], best.near_dist, prefetch_op_names[best.far_op], best.far_dist);
+    }
+    if (profile)
+        fflush(profile);
+}
+
+// Cache maintenance cost, the fpgamem ioctls and the user level dc civac/cvac
+// Every range is dirtied, then the operation is timed on all its lines, then the reload of the lines
+// The index operations are done on all the ways of the set of the line, the hit operations get the line address
+// Index writeback (1) and load tag (2) are FIBMAP and FIGETBSZ, the VFS takes them before the driver,
+// the tags are loaded through 11 instead. Store tag (3) and fetch and lock (7) are not measured,
+// they would corrupt or shrink the L2. The TLB operations are in the TLB test.
+#define CMO_CIVAC   -1
+#define CMO_CVAC    -2
+#define CMO_NONE    -3 // the reload without any operation, for the reference
+#define CMO_OPS     8
+
+const struct {
+    const char *name;
+    int cmd;    // ioctl number or CMO_*
+    int index;  // an index operation, L2_INDEX(set, way) as the argument
+} cmo_ops[CMO_OPS] = {
+    {"wbil2i", 0, 1}, {"ltgl2i", L2_IOCTL_LTG, 1}, {"invl2", 4, 0}, {"wbil2", 5, 0}, {"wbl2", 6, 0},
+    {"dc civac", CMO_CIVAC, 0}, {"dc cvac", CMO_CVAC, 0}, {"none", CMO_NONE, 0}
+};
+
+unsigned cmo_op;
+uint64_t cmo_reload[CPU_SETSIZE]; // reload time of the fastest run
+
+static __inline__ void cmo_line(void *p, int cmd, int index)
+{
+    uint64_t req[2], set;
+    unsigned way;
+
+    switch (cmd) {
+    case CMO_CIVAC:
+        cache_flush(p);
+        break;
+    case CMO_CVAC:
+        cache_clean(p);
+        break;
+    case CMO_NONE:
+        break;
+    default:
+        if (!index) {
+            ioctl(backend->fd, cmd, p);
+            break;
+        }
+        // the fpgamem mapping starts at the FPGA memory
+        set = L2_SET(FPGA_MEMORY_ADDRESS + ((uint8_t *)p - (uint8_t *)area));
+        for (way = 0; way < L2_WAYS; way++) {
+            req[0] = L2_INDEX(set, way);
+            if (cmd == L2_IOCTL_LTG)
+                ioctl(backend->fd, cmd, req);
+            else
+                ioctl(backend->fd, cmd, req[0]);
+        }
+        break;
+    }
+}
+
+void * thread_cmo(void *v)
+{
+    uint64_t min, cycles, op_cycles, reload_cycles;
+    uint64_t me = (uint64_t)v;
+    uint64_t k, r, reps;
+    uint8_t *a, *d, *e;
+    v4f tab = {1.0, 2.0, 3.0, 4.0};
+    int cmd = cmo_ops[cmo_op].cmd;
+    int index = cmo_ops[cmo_op].index;
+    uint64_t o;
+
+    a = area + (me * area_test_size);
+    e = area + (me * area_test_size) + area_test_size;
+    reps = area_test_size >= 1024 * line_size ? 1 : 1024 * line_size / area_test_size;
+    min = UINT64_MAX;
+
+    for (k = 0; k < 4; k++) {
+        pthread_barrier_wait(&barrier);
+        op_cycles = 0;
+        reload_cycles = 0;
+        for (r = 0; r < reps; r++) {
+            for (d = a; d < e; d += line_size) {
+                *(v4f *)d = tab;
+                asm("" : : "r" (d) : "memory");
+            }
+            mem_barrier();
+
+            cycles = now();
+            for (d = a; d < e; d += line_size)
+                cmo_line(d, cmd, index);
+            mem_barrier();
+            op_cycles += now() - cycles;
+
+            o = 0;
+            cycles = now();
+            for (d = a; d < e; d += line_size)
+                o |= ((volatile uint64_t *)d)[0];
+            asm("" : : "r" (o));
+            reload_cycles += now() - cycles;
+        }
+        if (op_cycles < min) {
+            min = op_cycles;
+            cmo_reload[me] = reload_cycles;
+        }
+    }
+    return (void *)min;
+}
+
+void do_cmo_test(void)
+{
+    uint64_t s, n, i, o, lines, reps, reload;
+
+    if (backend->type != BACKEND_FPGAMEM)
+        printf("The ioctls need the fpgamem backend, measuring only the user level operations\n");
+    for (n = 1; n <= no_threads; n = next_thread_count(n, no_threads)) {
+        printf("Cache maintenance, %ld thread(s)\n", n);
+        for (i = 7; i <= sweep_last(25); i += 3) { // from one line to 32MiB by default
+            area_test_size = 1UL << i;
+            lines = area_test_size / line_size;
+            reps = area_test_size >= 1024 * line_size ? 1 : 1024 * line_size / area_test_size;
+            for (cmo_op = 0; cmo_op < CMO_OPS; cmo_op++) {
+                if (cmo_ops[cmo_op].cmd >= 0 && backend->type != BACKEND_FPGAMEM)
+                    continue;
+#ifndef __aarch64__
+                if (cmo_ops[cmo_op].cmd == CMO_CVAC)
+                    continue;
+#endif
+                printf("Range: %s  %-9s", nice_size(area_test_size), cmo_ops[cmo_op].name);
+                s = start_threads(n, thread_cmo);
+                reload = 0;
+                for (o = 0; o < n; o++)
+                    reload += cmo_reload[o];
+                reload /= n;
+                printf("op %8.1fns/line %s/range  reload %8.1fns/line\n", (double)s / rate / (lines * reps),
+                    nice_time((double)s / reps), (double)reload / rate / (lines * reps));
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+// Stride sweep, every working set is walked at every stride
+// The latency is a pointer chase over the lines in a random cyclic order,
+// the bandwidth is a sequential strided read of one word per line by all the workers,
+// counting the whole line as transferred
+#define STRIDE_MIN_EXP 6            // 64B
+#define STRIDE_MAX_EXP 30           // 1GB
+#define STRIDE_WS_MIN_EXP 14        // 16KB
+#define STRIDE_MAX_LINES (1 << 20)  // lines touched by one point of the sweep
+
+uint64_t stride_size, stride_lines;
+
+void * thread_stride_read(void *v)
+{
+    uint64_t min, cycles;
+    uint64_t me = (uint64_t)v;
+    uint64_t j, k, l, step;
+    volatile uint64_t *p;
+    uint64_t o;
+
+    step = stride_size * pool_active / sizeof(uint64_t);
+    min = UINT64_MAX;
+    for (k = 0; k < 4; k++) {
+        pthread_barrier_wait(&barrier);
+        perf_start(me);
+        cycles = now();
+        for (j = 0; j < itn; j++) {
+            o = 0;
+            p = (uint64_t *)(area + me * stride_size);
+            for (l = me; l + 4 * pool_active <= stride_lines; l += 4 * pool_active) {
+                o |= p[0];
+                o |= p[step];
+                o |= p[2 * step];
+                o |= p[3 * step];
+                p += 4 * step;
+            }
+            for (; l < stride_lines; l += pool_active) {
+                o |= p[0];
+                p += step;
+            }
+            asm("" : : "r" (o));
+        }
+        cycles = now() - cycles;
+        perf_stop(me, cycles < min);
+        if (cycles < min)
+            min = cycles;
+    }
+    return (void *)min;
+}
+
+// Chase the pointers through the lines at the stride in a random cyclic order
+double do_stride_latency(uint64_t stride, uint64_t lines)
+{
+    uint32_t *order;
+    uint64_t i, j, n, p, diff, min;
+    void * volatile *c;
+
+    order = malloc(lines * sizeof(*order));
+    assert(order);
+    for (i = 0; i < lines; i++)
+        order[i] = i;
+    for (i = lines - 1; i > 0; i--) { // Sattolo's algorithm, a single cycle
+        uint32_t t;
+
+        j = (uint64_t)random() % i;
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (i = 0; i < lines; i++)
+        *(void **)(area + order[i] * stride) = area + order[(i + 1) % lines] * stride;
+    free(order);
+
+    n = lines < (1 << 16) ? (1 << 16) : lines;
+    n = (n + 7) & ~7UL;
+    min = UINT64_MAX;
+    for (p = 0; p < 3; p++) { // the first pass warms up
+        c = area;
+        diff = now();
+        for (i = 0; i < n; i += 8) {
+            c = *c;
+            c = *c;
+            c = *c;
+            c = *c;
+            c = *c;
+            c = *c;
+            c = *c;
+            c = *c;
+        }
+        asm("" : : "r" (c));
+        diff = now() - diff;
+        if (p > 0 && diff < min)
+            min = diff;
+    }
+    return (double)min / rate / n;
+}
+
+void do_stride_sweep(void)
+{
+    uint64_t ws, stride, s;
+    double latency;
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu_list[0], &cpus);
+    assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first core
+    printf("Stride sweep, %s pages, %d thread(s) for the bandwidth\n", backend->page_size ? nice_size(backend->page_size) : "base", no_threads);
+    for (ws = 1UL << STRIDE_WS_MIN_EXP; ws <= backend->used && (!sweep_max || ws <= sweep_max); ws *= 4) {
+        for (stride = 1UL << STRIDE_MIN_EXP; stride <= (1UL << STRIDE_MAX_EXP) && stride < ws; stride *= 2) {
+            stride_size = stride;
+            stride_lines = ws / stride;
+            if (stride_lines > STRIDE_MAX_LINES)
+                continue;
+            latency = do_stride_latency(stride, stride_lines);
+            itn = stride_lines >= (1 << 16) ? 1 : (1 << 16) / stride_lines;
+            s = start_threads(stride_lines < no_threads ? stride_lines : no_threads, thread_stride_read);
+            printf("WS:%s  Stride:%s  Lines:%8ld  Latency:%7.1fns  Bandwidth:%8.3fGB/s  ", nice_size(ws), nice_size(stride), stride_lines,
+                latency, (double)(stride_lines * (stride < line_size ? stride : line_size) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+            print_counters(pool_active);
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+}
+
+// TLB inspection, the uTLB and MTLB entries of the first core read through the fpgamem ioctls 12 and 13
+// after every access pattern, and the TLB miss latency from chasing a line per page against the same lines packed
+#define TLB_IOCTL_UTLB  12
+#define TLB_IOCTL_MTLB  13
+#define UTLB_ENTRIES    48      // CN88xx
+#define MTLB_ENTRIES    256
+// Entry as loaded by CVMCACHERDUTLB/RDMTLB, valid bit and the VA on one side, the page size and the PA on the other
+#define TLB_VALID(va)       ((va) & 1)
+#define TLB_VA(va)          ((va) & 0x0000fffffffff000UL)
+#define TLB_PAGE_EXP(pa)    (((pa) >> 56) & 0x3f)
+#define TLB_PAGE_SIZES      4
+
+const uint64_t tlb_page_sizes[TLB_PAGE_SIZES] = {1UL << 12, 1UL << 16, 1UL << 21, 1UL << 30};
+
+// Count the valid entries by page size, the last count is the other sizes, -1 if they can't be read
+int tlb_read(int fd, int cmd, unsigned entries, unsigned *counts, unsigned *in_area)
+{
+    uint64_t req[3], size;
+    unsigned i, j;
+
+    memset(counts, 0, (TLB_PAGE_SIZES + 1) * sizeof(*counts));
+    *in_area = 0;
+    for (i = 0; i < entries; i++) {
+        req[0] = i;
+        if (ioctl(fd, cmd, req) != 0)
+            return -1;
+        if (!TLB_VALID(req[1]))
+            continue;
+        size = 1UL << TLB_PAGE_EXP(req[2]);
+        for (j = 0; j < TLB_PAGE_SIZES && tlb_page_sizes[j] != size; j++)
+            ;
+        counts[j]++;
+        if (TLB_VA(req[1]) >= (uint64_t)area && TLB_VA(req[1]) < (uint64_t)area + backend->size)
+            (*in_area)++;
+    }
+    return 0;
+}
+
+void print_tlb(int fd, const char *pattern)
+{
+    unsigned counts[TLB_PAGE_SIZES + 1], in_area, i;
+
+    printf("%-24s", pattern);
+    if (tlb_read(fd, TLB_IOCTL_UTLB, UTLB_ENTRIES, counts, &in_area) == 0) {
+        printf("uTLB");
+        for (i = 0; i < TLB_PAGE_SIZES; i++)
+            printf(" %s:%-3d", nice_size(tlb_page_sizes[i]), counts[i]);
+        printf(" other:%-3d area:%-3d  ", counts[i], in_area);
+    }
+    if (tlb_read(fd, TLB_IOCTL_MTLB, MTLB_ENTRIES, counts, &in_area) == 0) {
+        printf("MTLB");
+        for (i = 0; i < TLB_PAGE_SIZES; i++)
+            printf(" %s:%-3d", nice_size(tlb_page_sizes[i]), counts[i]);
+        printf(" other:%-3d area:%-3d", counts[i], in_area);
+    }
+    printf("\n");
+}
+
+// Cost of the TLB operations of the fpgamem ioctls, reading an entry and prefetching a translation (10)
+#define TLB_IOCTL_PREFU 10
+#define TLB_OP_CALLS    1000
+
+void print_tlb_ops(int fd)
+{
+    static const struct {
+        const char *name;
+        int cmd;
+    } ops[] = {{"rdutlb", TLB_IOCTL_UTLB}, {"rdmtlb", TLB_IOCTL_MTLB}, {"prefutlb", TLB_IOCTL_PREFU}};
+    uint64_t req[3], t, k;
+    unsigned i;
+
+    printf("%-24s", "Cost per call");
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        t = now();
+        for (k = 0; k < TLB_OP_CALLS; k++) {
+            if (ops[i].cmd == TLB_IOCTL_PREFU) { // the address of a page of the area
+                ioctl(fd, ops[i].cmd, (uint8_t *)area + (k << 12) % backend->size);
+            } else {
+                req[0] = k % (ops[i].cmd == TLB_IOCTL_UTLB ? UTLB_ENTRIES : MTLB_ENTRIES);
+                ioctl(fd, ops[i].cmd, req);
+            }
+        }
+        printf("%s %.1fns  ", ops[i].name, (double)(now() - t) / rate / TLB_OP_CALLS);
+    }
+    printf("\n");
+}
+
+void do_tlb_test(void)
+{
+    uint64_t i, n, page;
+    double spread, packed;
+    cpu_set_t cpus;
+    char name[64];
+    int fd = -1;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu_list[0], &cpus);
+    assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first core, the TLBs are per core
+    printf("TLB, %s pages\n", backend->page_size ? nice_size(backend->page_size) : "base");
+#ifdef __aarch64__
+    fd = backend->type == BACKEND_FPGAMEM ? backend->fd : open("/dev/fpgamem", O_RDWR);
+#endif
+    if (fd < 0) {
+        printf("The TLB reads need /dev/fpgamem on aarch64, measuring only the miss latency\n");
+    } else {
+        print_tlb_ops(fd);
+        print_tlb(fd, "Idle");
+        do_stride_latency(line_size, (1 << 25) / line_size);
+        print_tlb(fd, "Lines of 32MB");
+        for (i = 0; i < TLB_PAGE_SIZES; i++) {
+            n = backend->size / (tlb_page_sizes[i] + line_size);
+            if (n < 2)
+                continue;
+            do_stride_latency(tlb_page_sizes[i] + line_size, n < 2 * MTLB_ENTRIES ? n : 2 * MTLB_ENTRIES);
+            snprintf(name, sizeof(name), "Line per %s page", nice_size(tlb_page_sizes[i]));
+            print_tlb(fd, name);
+        }
+    }
+// the same lines chased packed and spread one per page, beyond the reach of the MTLB
+    for (i = 0; i < TLB_PAGE_SIZES; i++) {
+        page = tlb_page_sizes[i];
+        n = backend->size / (page + line_size);
+        if (n > 2 * MTLB_ENTRIES)
+            n = 2 * MTLB_ENTRIES;
+        if (n <= MTLB_ENTRIES) {
+            printf("Stride:%s  only %ld pages in the area, they fit in the MTLB\n", nice_size(page), n);
+            continue;
+        }
+        packed = do_stride_latency(line_size, n);
+        spread = do_stride_latency(page + line_size, n);
+        printf("Stride:%s  Pages:%4ld  Packed:%7.1fns  Spread:%7.1fns  TLB miss:%7.1fns%s\n", nice_size(page), n, packed, spread,
+            spread > packed ? spread - packed : 0.0, backend->page_size > page ? "  (several per page)" : "");
+    }
+    if (fd >= 0 && backend->type != BACKEND_FPGAMEM)
+        close(fd);
+}
+
+// core-to-core test
+#define C2C_ROUNDS 1000
+#define C2C_FPGA_LINES 0x8000000080UL // addresses of FPGA cache lines, relative to the FPGA memory
+
+struct c2c_pair {
+    volatile uint64_t *data;        // two cache lines, [0] written by the first thread, [16] by the second one
+    int counted;                    // the first thread counts into the SELF_WORKER slot, one pair at a time
+    int cpu[2];                     // second cpu == -1 means the FPGA
+    uint64_t samples[C2C_ROUNDS];   // round trip times
+    uint64_t total;                 // time of all the round trips
+};
+
+void * thread_c2c_1(void *f)
+{
+    struct c2c_pair *p = f;
+    volatile uint64_t *c2c_data = p->data;
+    int64_t i;
+    uint64_t cycle, t;
+
+    c2c_data[0] = 1;
+    c2c_data[16] = 1;
+    if (p->counted)
+        perf_self_open();
+    pthread_barrier_wait(&barrier);
+    if (p->counted)
+        perf_self_start();
+    cycle = now();
+    for (i = C2C_ROUNDS; i >= 0; i--) {
+        t = now();
+        c2c_data[0] = i;
+        __sync_synchronize();
+        while (i != c2c_data[16])
+            ;
+        if (i < C2C_ROUNDS)
+            p->samples[i] = now() - t;
+    }
+    p->total = now() - cycle;
+    if (p->counted) {
+        perf_self_stop(1);
+        perf_self_close();
+    }
+    return (void *)p->total;
+}
+
+void * thread_c2c_2(void *f)
+{
+    struct c2c_pair *p = f;
+    volatile uint64_t *c2c_data = p->data;
+
+    pthread_barrier_wait(&barrier);
+    for (;;) {
+        uint64_t v;
+
+        v = c2c_data[0];
+        c2c_data[16] = v;
+        __sync_synchronize();
+        if (v == 0)
+            break;
+    }
+    return NULL;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Sort the round trip samples and return the percentile of one trip in ns
+double c2c_percentile(struct c2c_pair *p, double percentile)
+{
+    qsort(p->samples, C2C_ROUNDS, sizeof(p->samples[0]), compare_uint64);
+    return p->samples[(uint64_t)((C2C_ROUNDS - 1) * percentile / 100)] / rate / 2;
+}
+
+// Add the counts of the first thread of the last run of pairs
+void c2c_add_counts(uint64_t *total)
+{
+    unsigned j;
+
+    if (!workers[SELF_WORKER].counts_valid)
+        return;
+    for (j = 0; j < PERF_EVENTS; j++)
+        total[j] += workers[SELF_WORKER].counts[j];
+}
+
+// Run the ping-pong on several pairs at once, one page per pair
+void run_c2c_pairs(struct c2c_pair *pairs, unsigned no_pairs)
+{
+    pthread_t tids[2 * no_pairs];
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    unsigned i, j, n;
+
+    n = 0;
+    for (i = 0; i < no_pairs; i++) {
+        n += pairs[i].cpu[1] != -1 ? 2 : 1;
+        pairs[i].counted = i == 0;
+    }
+    pthread_barrier_init(&barrier, NULL, n + 1);
+    for (i = 0; i < no_pairs; i++) {
+        for (j = 0; j < 2; j++) {
+            if (pairs[i].cpu[j] == -1)
+                continue;
+            pthread_attr_init(&attr);
+            CPU_ZERO(&cpus);
+            CPU_SET(pairs[i].cpu[j], &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+            pthread_create(tids + 2 * i + j, &attr, j ? thread_c2c_2 : thread_c2c_1, pairs + i);
+            pthread_attr_destroy(&attr);
+        }
+    }
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < no_pairs; i++) {
+        for (j = 0; j < 2; j++) {
+            if (pairs[i].cpu[j] != -1)
+                pthread_join(tids[2 * i + j], NULL);
+        }
+    }
+    pthread_barrier_destroy(&barrier);
+}
+
+// Do the core-2-core test
+// Launch 2 threads:
+//  1. Write a value to the first cacheline and wait till it appears in the second one
+//  2. Read a value from the first cacheline and write it to the second one
+// Repeat 1000 times
+// if second_cpu == -1 then do the test with the FPGA
+uint64_t do_c2c_test(int first_cpu, int second_cpu)
+{
+    static struct c2c_pair pair;
+
+    if (second_cpu == - 1) // use the FPGA
+        pair.data = area + C2C_FPGA_LINES;
+    else // or another CPU thread
+        pair.data = area;
+    pair.cpu[0] = first_cpu;
+    pair.cpu[1] = second_cpu;
+    run_c2c_pairs(&pair, 1);
+
+    return pair.total;
+}
+
+void print_c2c_matrix(const char *title, double *m, unsigned n, unsigned fpga)
+{
+    unsigned i, j;
+
+    printf("%s, one trip in ns\n     ", title);
+    for (j = 0; j < n; j++)
+        printf("%6d", cpu_list[j]);
+    if (fpga)
+        printf("  FPGA");
+    printf("\n");
+    for (i = 0; i < n; i++) {
+        printf("%4d ", cpu_list[i]);
+        for (j = 0; j < n + fpga; j++) {
+            if (i == j)
+                printf("     -");
+            else
+                printf("%6.0f", m[i * (n + 1) + j]);
+        }
+        printf("\n");
+    }
+}
+
+static const unsigned c2c_matrix_percentiles[] = {50, 90, 99};
+
+// Run a batch of concurrent pairs of the matrix, both cells of a pair get its latency
+static void c2c_matrix_batch(struct c2c_pair *pairs, unsigned (*index)[2], unsigned no_pairs, unsigned n,
+                             double **m, char *written, uint64_t *counts, double *trips_rate)
+{
+    unsigned k, p;
+
+    run_c2c_pairs(pairs, no_pairs);
+    c2c_add_counts(counts);
+    for (k = 0; k < no_pairs; k++) {
+        unsigned x = index[k][0], y = index[k][1];
+
+        *trips_rate += (double)(C2C_ROUNDS + 1) * rate * 1000.0 / pairs[k].total;
+        for (p = 0; p < 3; p++) {
+            m[p][x * (n + 1) + y] = c2c_percentile(pairs + k, c2c_matrix_percentiles[p]);
+            m[p][y * (n + 1) + x] = m[p][x * (n + 1) + y];
+        }
+        written[x * n + y] = written[y * n + x] = 1;
+    }
+}
+
+// Do the core-2-core test for every pair of the selected cores and for every core with the FPGA
+// With concurrency > 1, the pairs are scheduled as a round-robin tournament, so every core
+// is in one pair at a time, and up to concurrency pairs run at once
+void do_c2c_matrix(unsigned concurrency)
+{
+    const unsigned *percentiles = c2c_matrix_percentiles;
+    unsigned n = no_threads;
+    unsigned players = n + (n & 1); // add a dummy core for the odd count
+    unsigned fpga = !use_cpu_memory;
+    unsigned r, i, k, no_pairs;
+    struct c2c_pair *pairs;
+    double *m[3];
+    char *written;  // off-diagonal cells measured
+    double trips_rate;
+    unsigned batches;
+    uint64_t counts[PERF_EVENTS];
+
+    pairs = calloc(players / 2 + 1, sizeof(*pairs));
+    assert(pairs);
+    for (k = 0; k < 3; k++) {
+        m[k] = calloc(n * (n + 1), sizeof(double));
+        assert(m[k]);
+    }
+    written = calloc(n * n, 1);
+    assert(written);
+    if (concurrency == 0)
+        concurrency = 1;
+
+    trips_rate = 0.0;
+    batches = 0;
+    memset(counts, 0, sizeof(counts));
+    if (concurrency == 1) { // every ordered pair alone
+        for (i = 0; i < n; i++) {
+            for (r = 0; r < n; r++) {
+                if (i == r)
+                    continue;
+                pairs[0].data = area;
+                pairs[0].cpu[0] = cpu_list[i];
+                pairs[0].cpu[1] = cpu_list[r];
+                run_c2c_pairs(pairs, 1);
+                c2c_add_counts(counts);
+                for (k = 0; k < 3; k++)
+                    m[k][i * (n + 1) + r] = c2c_percentile(pairs, percentiles[k]);
+                written[i * n + r] = 1;
+            }
+        }
+    } else {
+        for (r = 0; r < players - 1; r++) {
+            unsigned pos[players];
+            unsigned index[players / 2][2];
+
+            // circle method, core 0 is fixed, the others rotate
+            pos[0] = 0;
+            for (i = 1; i < players; i++)
+                pos[i] = (r + i - 1) % (players - 1) + 1;
+            no_pairs = 0;
+            for (i = 0; i < players / 2; i++) {
+                unsigned a = pos[i], b = pos[players - 1 - i];
+
+                if (a >= n || b >= n) // the dummy core
+                    continue;
+                pairs[no_pairs].data = area + no_pairs * 4096;
+                pairs[no_pairs].cpu[0] = cpu_list[a];
+                pairs[no_pairs].cpu[1] = cpu_list[b];
+                index[no_pairs][0] = a;
+                index[no_pairs][1] = b;
+                no_pairs++;
+                if (no_pairs == concurrency) {
+                    c2c_matrix_batch(pairs, index, no_pairs, n, m, written, counts, &trips_rate);
+                    batches++;
+                    no_pairs = 0;
+                }
+            }
+            // the rest of the round, also when the dummy core took the last slot
+            if (no_pairs) {
+                c2c_matrix_batch(pairs, index, no_pairs, n, m, written, counts, &trips_rate);
+                batches++;
+            }
+        }
+    }
+    for (i = 0; i < n; i++)
+        for (r = 0; r < n; r++)
+            assert(i == r || written[i * n + r]);
+    if (fpga) { // every core with the FPGA, there's only one pair of FPGA lines
+        for (i = 0; i < n; i++) {
+            pairs[0].data = area + C2C_FPGA_LINES;
+            pairs[0].cpu[0] = cpu_list[i];
+            pairs[0].cpu[1] = -1;
+            run_c2c_pairs(pairs, 1);
+            c2c_add_counts(counts);
+            for (k = 0; k < 3; k++)
+                m[k][i * (n + 1) + n] = c2c_percentile(pairs, percentiles[k]);
+        }
+    }
+
+    for (k = 0; k < 3; k++) {
+        char title[64];
+
+        snprintf(title, sizeof(title), "Core-2-core latency p%d", percentiles[k]);
+        print_c2c_matrix(title, m[k], n, fpga);
+    }
+    if (concurrency > 1 && batches)
+        printf("Up to %d concurrent pairs: %.3f M round trips/s on average\n", concurrency, trips_rate / batches);
+    if (do_perf && workers[SELF_WORKER].perf_fd[0] >= 0) {
+        printf("Counters of the first pinging thread, all the runs: ");
+        print_counts(counts, workers + SELF_WORKER);
+        printf("\n");
+    }
+
+    for (k = 0; k < 3; k++)
+        free(m[k]);
+    free(written);
+    free(pairs);
+}
+
+
+// Message ring between cores in the tested memory, slots of one cache line
+// Bounded MPSC queue: the slot sequence is pos when free for position pos, pos + 1 when full,
+// the consumer is worker 0, the producers are the next workers
+// Producers claim batch positions at once, the consumer frees the slots in batches
+// The positions keep counting over the runs, run k has its own tail starting at k * RING_MESSAGES,
+// so a producer late in claiming can't take a position of the next run
+#define RING_MESSAGES (1 << 20)
+#define RING_SAMPLES RING_MESSAGES
+
+struct ring_slot {
+    uint64_t seq;
+    uint64_t ts;    // time of sending
+    uint64_t payload[CACHELINE_SIZE / 8 - 2];
+};
+
+unsigned ring_depth = 64, ring_batch = 1, ring_producers = 1;
+uint64_t *ring_samples;     // latencies of 2 runs, the one measured and the fastest one so far
+unsigned ring_best;         // half of ring_samples with the fastest run
+
+void * thread_ring(void *v)
+{
+    uint64_t min, cycles;
+    uint64_t me = (uint64_t)v;
+    uint64_t k, pos, b, n, o, base, end;
+    volatile uint64_t *tails = area; // the tail of every run, shared by the producers, in its own line
+    volatile uint64_t *tail;
+    struct ring_slot *ring = area + 5 * CACHELINE_SIZE;
+    struct ring_slot *slot;
+    uint64_t *samples;
+
+    if (me == 0) { // reset once, before everybody passes the first barrier
+        for (k = 0; k < 4; k++)
+            tails[k * CACHELINE_SIZE / 8] = k * RING_MESSAGES;
+        for (pos = 0; pos < ring_depth; pos++)
+            ring[pos].seq = pos;
+        mem_barrier();
+    }
+    min = UINT64_MAX;
+    for (k = 0; k < 4; k++) {
+        base = k * RING_MESSAGES;
+        end = base + RING_MESSAGES;
+        tail = tails + k * CACHELINE_SIZE / 8;
+        pthread_barrier_wait(&barrier);
+        perf_start(me);
+        cycles = now();
+        if (me == 0) { // consumer
+            samples = ring_samples + (ring_best ^ 1) * RING_SAMPLES;
+            o = 0;
+            b = base; // first position not freed yet
+            for (pos = base; pos < end; pos++) {
+                slot = ring + (pos & (ring_depth - 1));
+                while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+                    ;
+                samples[pos - base] = now() - slot->ts;
+                o += slot->payload[0];
+                if ((pos + 1) % ring_batch == 0) {
+                    for (; b <= pos; b++)
+                        __atomic_store_n(&ring[b & (ring_depth - 1)].seq, b + ring_depth, __ATOMIC_RELEASE);
+                }
+            }
+            for (; b < end; b++) // the partial last batch, the next run starts from free slots
+                __atomic_store_n(&ring[b & (ring_depth - 1)].seq, b + ring_depth, __ATOMIC_RELEASE);
+            asm("" : : "r" (o));
+        } else if (ring_producers == 1) { // single producer, no claiming
+            for (pos = base; pos < end; pos++) {
+                slot = ring + (pos & (ring_depth - 1));
+                while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos)
+                    ;
+                slot->ts = now();
+                slot->payload[0] = pos;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+            }
+        } else {
+            for (;;) {
+                pos = __atomic_fetch_add(tail, ring_batch, __ATOMIC_RELAXED);
+                if (pos >= end)
+                    break;
+                for (n = pos; n < pos + ring_batch && n < end; n++) {
+                    slot = ring + (n & (ring_depth - 1));
+                    while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != n)
+                        ;
+                    slot->ts = now();
+                    slot->payload[0] = n;
+                    __atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+                }
+            }
+        }
+        cycles = now() - cycles;
+        perf_stop(me, cycles < min);
+        if (cycles < min) {
+            min = cycles;
+            if (me == 0) // keep the latencies of the run reported
+                ring_best ^= 1;
+        }
+    }
+    return (void *)min;
+}
+
+void do_ring_test(void)
+{
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    uint64_t s, i, *samples;
+
+    if (ring_producers + 1 > no_threads) {
+        printf("The ring test needs %d cores, 1 consumer and %d producer(s)\n", ring_producers + 1, ring_producers);
+        return;
+    }
+    ring_samples = malloc(2 * RING_SAMPLES * sizeof(*ring_samples));
+    assert(ring_samples);
+    ring_best = 1;
+    printf("Ring depth %d, batch %d, consumer on CPU %d, %d producer(s) on CPU", ring_depth, ring_batch, cpu_list[0], ring_producers);
+    for (i = 1; i <= ring_producers; i++)
+        printf(" %d", cpu_list[i]);
+    printf("\n");
+    start_threads(ring_producers + 1, thread_ring);
+    s = workers[0].result;
+    samples = ring_samples + ring_best * RING_SAMPLES;
+    qsort(samples, RING_SAMPLES, sizeof(*samples), compare_uint64);
+    printf("Messages: %d  %s  %.3fMmsg/s  ", RING_MESSAGES, nice_time(s), (double)RING_MESSAGES * rate * 1000.0 / s);
+    for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        printf("p%g %.1fns  ", percentiles[i], samples[(uint64_t)((RING_SAMPLES - 1) * percentiles[i] / 100)] / rate);
+    printf("(fastest of 4 runs)\t");
+    print_counters(ring_producers + 1);
+    printf("\n");
+    free(ring_samples);
+
+    if (backend->type == BACKEND_FPGAMEM) { // the FPGA agent only echoes one line, one message in flight
+        struct c2c_pair *pair = calloc(1, sizeof(*pair));
+
+        assert(pair);
+        pair->data = area + C2C_FPGA_LINES;
+        pair->cpu[0] = cpu_list[0];
+        pair->cpu[1] = -1;
+        run_c2c_pairs(pair, 1);
+        printf("Core %d <-> FPGA agent, depth 1: %.3fMmsg/s  ", cpu_list[0], (double)(C2C_ROUNDS + 1) * rate * 1000.0 / pair->total);
+        for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+            printf("p%g %.1fns  ", percentiles[i], c2c_percentile(pair, percentiles[i]));
+        printf("(one trip)\t");
+        print_self_counters();
+        printf("\n");
+        free(pair);
+    }
+}
+
+// Core count scaling of write, clear, read and copy at 1, 2, 4 ... threads,
+// compact (the first selected cores) and spread (evenly over the selected cores)
+// The copy goes from the first half of the area to the second one
+#define SCALING_KERNELS 4
+#define SCALING_MAX_EXP 32  // 4GB per thread by default
+#define SCALING_SATURATION 0.95
+
+void do_scaling_sweep(void)
+{
+    static const char *names[SCALING_KERNELS] = {"write", "clear", "read", "copy"};
+    void * (*kernels[SCALING_KERNELS])(void *) = {thread_write_cache_area, thread_clear_cache_area, thread_read_cache_area, thread_copy_area};
+    uint64_t map[CPU_SETSIZE];
+    uint64_t counts[64];
+    double aggregate[SCALING_KERNELS][64];
+    uint64_t i, n, t, s, e, placement, no_counts;
+    double bw, lo, hi, best;
+
+    no_counts = 0;
+    for (n = 1; n <= no_threads; n = next_thread_count(n, no_threads))
+        counts[no_counts++] = n;
+    copy_src = area;
+    copy_dst = area + backend->used / 2;
+    copy_kernel = COPY_LDP_STP;
+    for (placement = 0; placement < 2; placement++) {
+        printf("Scaling, %s placement\n", placement ? "spread" : "compact");
+        for (i = sweep_first(); i <= sweep_last(SCALING_MAX_EXP) && (1UL << i) * no_threads <= backend->used / 2; i++) {
+            area_test_size = 1UL << i;
+            itn = i > 22 ? 1: 1 << (22 - i);
+            printf("Size: %s\n", nice_size(area_test_size));
+            for (t = 0; t < no_counts; t++) {
+                n = counts[t];
+                printf("Threads: %3ld  CPUs:", n);
+                for (s = 0; s < n; s++) {
+                    map[s] = placement ? s * no_threads / n : s;
+                    printf(" %d", cpu_list[map[s]]);
+                }
+                printf("\n");
+                for (e = 0; e < SCALING_KERNELS; e++) {
+                    s = start_threads_on(n, map, kernels[e]);
+                    aggregate[e][t] = (double)(area_test_size * n * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0;
+                    lo = 1e300;
+                    hi = 0.0;
+                    for (s = 0; s < n; s++) {
+                        bw = (double)(area_test_size * itn) * rate * 1000000000.0 / workers[s].result / 1048576.0 / 1024.0;
+                        lo = bw < lo ? bw : lo;
+                        hi = bw > hi ? bw : hi;
+                    }
+                    printf("    %-5s %8.3fGB/s  per thread %.3f..%.3fGB/s  fairness %.2f\t", names[e], aggregate[e][t], lo, hi, lo / hi);
+                    print_counters(n);
+                    printf("\n");
+                    fflush(stdout);
+                }
+            }
+            printf("Saturation:");
+            for (e = 0; e < SCALING_KERNELS; e++) {
+                best = 0.0;
+                for (t = 0; t < no_counts; t++)
+                    best = aggregate[e][t] > best ? aggregate[e][t] : best;
+                for (t = 0; t < no_counts && aggregate[e][t] < best * SCALING_SATURATION; t++)
+                    ;
+                printf("  %s %ld thread(s) %.3fGB/s", names[e], counts[t], best);
+            }
+            printf("\n");
+        }
+    }
+}
+
+// Time series of the stress runs, sampled at a fixed interval into a ring buffer and exported
+// as CSV or JSON lines to a file, or as JSON lines to the clients of a Unix socket
+#define STRESS_RING     4096    // samples kept, a new socket client gets them first
+#define SINK_NONE       0
+#define SINK_CSV        1
+#define SINK_JSON       2
+#define SINK_UNIX       3
+#define SINK_CLIENTS    8
+
+struct stress_sample {
+    uint64_t timestamp;         // CLOCK_REALTIME, ns
+    double elapsed;             // s since the start
+    double total;               // GB/s of all the threads
+    float *bandwidth;           // GB/s per thread
+    float *latency;             // ns per line per thread
+};
+
+struct stress_sample *stress_ring;
+uint64_t stress_samples;        // taken so far, the ring holds the last STRESS_RING
+double stress_interval = 1.0;   // s
+double stress_duration;         // s, 0 for ever
+unsigned stress_sink;
+char stress_sink_path[256];
+FILE *stress_out;
+int stress_listen = -1;
+int stress_clients[SINK_CLIENTS];
+const char *stress_names[] = {"", "write", "clear", "read", "latency"};
+
+// Parse the -o argument, csv:path, json:path or unix:path, - is the standard output
+void parse_stress_sink(const char *spec)
+{
+    const char *arg = strchr(spec, ':');
+
+    if (!arg || !arg[1]) {
+        fprintf(stderr, "Invalid output: %s\n", spec);
+        exit(1);
+    }
+    if (!strncmp(spec, "csv:", 4)) {
+        stress_sink = SINK_CSV;
+    } else if (!strncmp(spec, "json:", 5)) {
+        stress_sink = SINK_JSON;
+    } else if (!strncmp(spec, "unix:", 5)) {
+        stress_sink = SINK_UNIX;
+    } else {
+        fprintf(stderr, "Unsupported output: %s\n", spec);
+        exit(1);
+    }
+    snprintf(stress_sink_path, sizeof(stress_sink_path), "%s", arg + 1);
+}
 
-    do {
-        min = UINT64_MAX;
-        for (p = 0; p < 5; p++) {
-            cycle = now();
-            o = 0;
-            for (i = 0; i < l; i += 8) {
-                o |= c[i][0][0];
-                o |= c[i + 1][0][0];
-                o |= c[i + 2][0][0];
-                o |= c[i + 3][0][0];
-                o |= c[i + 4][0][0];
-                o |= c[i + 5][0][0];
-                o |= c[i + 6][0][0];
-                o |= c[i + 7][0][0];
-                asm("":: "r" (o));
-            }
-            diff = now() - cycle;
-            if (p > 0 && diff < min)
-                min = diff;
-        }
-        avg = min;
-        t = (double)(avg - base) / rate / l;
-        printf("Size:%s  Latency:%4.1fns  Cycles:%ld\n", nice_size(1 << size), t, (uint64_t)(t * 2 + 0.5));
-    } while (size == 0);
+// Format a sample, the CSV header for NULL
+int format_sample(char *buf, size_t len, const struct stress_sample *sample, unsigned json)
+{
+    size_t o;
+    unsigned i;
+    unsigned cols = do_stress == 4 ? 1 : no_threads; // the latency mode samples only the first core
+
+    if (!sample) {
+        o = snprintf(buf, len, "timestamp_ns,elapsed_s,mode,total_gbps");
+        for (i = 0; i < cols && o < len; i++)
+            o += snprintf(buf + o, len - o, ",cpu%u_gbps,cpu%u_ns_per_line", cpu_list[i], cpu_list[i]);
+    } else if (json) {
+        o = snprintf(buf, len, "{\"timestamp\":%ld,\"elapsed\":%.3f,\"mode\":\"%s\",\"total\":%.3f,\"threads\":[",
+            sample->timestamp, sample->elapsed, stress_names[do_stress], sample->total);
+        for (i = 0; i < cols && o < len; i++)
+            o += snprintf(buf + o, len - o, "%s{\"cpu\":%u,\"gbps\":%.3f,\"ns_per_line\":%.2f}", i ? "," : "", cpu_list[i],
+                sample->bandwidth[i], sample->latency[i]);
+        if (o < len)
+            o += snprintf(buf + o, len - o, "]}");
+    } else {
+        o = snprintf(buf, len, "%ld,%.3f,%s,%.3f", sample->timestamp, sample->elapsed, stress_names[do_stress], sample->total);
+        for (i = 0; i < cols && o < len; i++)
+            o += snprintf(buf + o, len - o, ",%.3f,%.2f", sample->bandwidth[i], sample->latency[i]);
+    }
+    if (o + 1 < len) {
+        buf[o++] = '\n';
+        buf[o] = 0;
+    }
+    return o < len ? o : len - 1;
 }
 
-// core-to-core test
-static volatile uint64_t *c2c_data;
+void stress_open(void)
+{
+    struct sockaddr_un addr;
+    char buf[65536];
+    uint64_t i;
+
+    stress_ring = calloc(STRESS_RING, sizeof(*stress_ring));
+    assert(stress_ring);
+    for (i = 0; i < STRESS_RING; i++) {
+        stress_ring[i].bandwidth = calloc(no_threads, sizeof(float));
+        stress_ring[i].latency = calloc(no_threads, sizeof(float));
+        assert(stress_ring[i].bandwidth && stress_ring[i].latency);
+    }
+    stress_samples = 0;
+    for (i = 0; i < SINK_CLIENTS; i++)
+        stress_clients[i] = -1;
+    if (stress_sink == SINK_CSV || stress_sink == SINK_JSON) {
+        stress_out = strcmp(stress_sink_path, "-") ? fopen(stress_sink_path, "w") : stdout;
+        if (!stress_out) {
+            perror(stress_sink_path);
+            exit(1);
+        }
+        if (stress_sink == SINK_CSV) {
+            format_sample(buf, sizeof(buf), NULL, 0);
+            fputs(buf, stress_out);
+        }
+    } else if (stress_sink == SINK_UNIX) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(stress_sink_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", stress_sink_path);
+            exit(1);
+        }
+        strncpy(addr.sun_path, stress_sink_path, sizeof(addr.sun_path) - 1);
+        unlink(stress_sink_path);
+        stress_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (stress_listen < 0 || bind(stress_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(stress_listen, SINK_CLIENTS) != 0) {
+            perror(stress_sink_path);
+            exit(1);
+        }
+        printf("Serving the samples on %s\n", stress_sink_path);
+    }
+}
 
-void * thread_c2c_1(void *f)
+// Send to a socket client without blocking the sampling, a client that can't keep up is dropped
+int stress_send(int *fd, const char *buf, size_t len)
 {
-    int64_t i;
-    uint64_t cycle;
+    if (*fd >= 0 && send(*fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len) {
+        close(*fd);
+        *fd = -1;
+    }
+    return *fd >= 0;
+}
 
-    c2c_data[0] = 1;
-    c2c_data[16] = 1;
-    pthread_barrier_wait(&barrier);
-    cycle = now();
-    for (i = 1000; i >= 0; i--) {
-        c2c_data[0] = i;
-        __sync_synchronize();
-        while (i != c2c_data[16])
-            ;
+// Write out the last sample, new socket clients get the history in the ring first
+void stress_export(void)
+{
+    const struct stress_sample *sample = stress_ring + (stress_samples - 1) % STRESS_RING;
+    char buf[65536];
+    uint64_t i, j;
+    int fd, len;
+
+    if (stress_out) {
+        format_sample(buf, sizeof(buf), sample, stress_sink == SINK_JSON);
+        fputs(buf, stress_out);
+        fflush(stress_out);
+    } else if (stress_listen >= 0) {
+        while ((fd = accept(stress_listen, NULL, NULL)) >= 0) {
+            for (i = 0; i < SINK_CLIENTS && stress_clients[i] >= 0; i++)
+                ;
+            if (i == SINK_CLIENTS) {
+                close(fd);
+                continue;
+            }
+            stress_clients[i] = fd;
+            for (j = stress_samples > STRESS_RING ? stress_samples - STRESS_RING : 0; j < stress_samples - 1; j++) {
+                len = format_sample(buf, sizeof(buf), stress_ring + j % STRESS_RING, 1);
+                if (!stress_send(stress_clients + i, buf, len))
+                    break;
+            }
+        }
+        len = format_sample(buf, sizeof(buf), sample, 1);
+        for (i = 0; i < SINK_CLIENTS; i++)
+            stress_send(stress_clients + i, buf, len);
     }
-    cycle = now() - cycle;
-    return (void *)cycle;
 }
 
-void * thread_c2c_2(void *f)
+void stress_close(void)
 {
-    pthread_barrier_wait(&barrier);
-    for (;;) {
-        uint64_t v;
+    uint64_t i;
+
+    if (stress_out && stress_out != stdout)
+        fclose(stress_out);
+    stress_out = NULL;
+    if (stress_listen >= 0) {
+        for (i = 0; i < SINK_CLIENTS; i++)
+            if (stress_clients[i] >= 0)
+                close(stress_clients[i]);
+        close(stress_listen);
+        unlink(stress_sink_path);
+        stress_listen = -1;
+    }
+    for (i = 0; i < STRESS_RING; i++) {
+        free(stress_ring[i].bandwidth);
+        free(stress_ring[i].latency);
+    }
+    free(stress_ring);
+}
 
-        v = c2c_data[0];
-        c2c_data[16] = v;
-        __sync_synchronize();
-        if (v == 0)
+// Stress with 32MB blocks per thread, one sample per interval until the duration
+// The passes of the bandwidth kernels follow the time of the last sample, the latency mode sleeps the rest of it
+void do_stress_test(void)
+{
+    void * (*kernels[])(void *) = {NULL, thread_write_cache_area, thread_clear_cache_area, thread_read_cache_area};
+    struct stress_sample *sample;
+    struct timespec ts;
+    uint64_t start, t, s, i;
+    cpu_set_t cpus;
+
+    printf("Stressing, %s every %.3fs", stress_names[do_stress], stress_interval);
+    if (stress_duration)
+        printf(" for %gs", stress_duration);
+    printf("...\n");
+    area_test_size = 1 << 25; // 32MiB
+    stress_open();
+    if (do_stress == 4) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu_list[0], &cpus);
+        assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first core
+    } else { // a run does 4 times itn passes
+        itn = 1;
+        t = now1();
+        start_threads(no_threads, kernels[do_stress]);
+        t = now1() - t;
+        itn = stress_interval * 1000000000.0 / t;
+        if (itn == 0)
+            itn = 1;
+    }
+    start = now1();
+    for (;;) {
+        t = now1();
+        sample = stress_ring + stress_samples % STRESS_RING;
+        if (do_stress == 4) {
+            sample->latency[0] = do_seq_latency_test(0);
+            sample->bandwidth[0] = line_size / sample->latency[0] * 1000000000.0 / 1048576.0 / 1024.0; // one line at a time
+            sample->total = sample->bandwidth[0];
+        } else {
+            s = start_threads(no_threads, kernels[do_stress]);
+            printf("%s %s %.3fGB/s\t", stress_names[do_stress], nice_time(s), (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+            print_counters(no_threads);
+            printf("\n");
+            sample->total = 0;
+            for (i = 0; i < no_threads; i++) {
+                sample->bandwidth[i] = (double)(area_test_size * itn) * rate * 1000000000.0 / workers[i].result / 1048576.0 / 1024.0;
+                sample->latency[i] = (double)workers[i].result / rate / (area_test_size * itn / line_size);
+                sample->total += sample->bandwidth[i];
+            }
+        }
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sample->timestamp = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+        sample->elapsed = (now1() - start) / 1000000000.0;
+        stress_samples++;
+        stress_export();
+        fflush(stdout);
+        if (stress_duration && sample->elapsed >= stress_duration)
             break;
+        t = now1() - t;
+        if (do_stress == 4 && t < stress_interval * 1000000000.0)
+            usleep((stress_interval * 1000000000.0 - t) / 1000);
+        if (do_stress != 4) {
+            itn = itn * stress_interval * 1000000000.0 / t;
+            if (itn == 0)
+                itn = 1;
+        }
     }
-    return NULL;
+    stress_close();
 }
 
-// Do the core-2-core test
-// Launch 2 threads:
-//  1. Write a value to the first cacheline and wait till it appears in the second one
-//  2. Read a value from the first cacheline and write it to the second one
-// Repeat 1000 times
-// if second_cpu == -1 then do the test with the FPGA
-uint64_t do_c2c_test(int first_cpu, int second_cpu)
+// Run all the selected tests on the mapped area
+void run_tests(void)
 {
-    pthread_t tids[2];
-    pthread_attr_t attr;
-    cpu_set_t cpus;
-    uint64_t retval;
+    uint64_t i;
+
+    if (do_overall) { // use 2 threads
+        uint64_t s;
+        uint64_t cycle;
+        cpu_set_t cpus;
+
+        area_test_size = 1 << 25; // 32MB
+        itn = 1;
+
+        printf("Throughput:\t");
+        fflush(stdout);
+
+        s = start_threads(no_threads, thread_write_cache_area);
+        printf("write %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+        print_counters(no_threads);
+        fflush(stdout);
+
+        s = start_threads(no_threads, thread_clear_cache_area);
+        printf("clear %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+        print_counters(no_threads);
+        fflush(stdout);
+
+        s = start_threads(no_threads, thread_read_cache_area);
+        printf("read %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+        print_counters(no_threads);
+        printf("\n");
+
+        cycle = do_c2c_test(cpu_list[0], use_cpu_memory ? (int)cpu_list[no_threads - 1] : -1);
+        printf("Core-2-core (one trip, 3 hops) latency is %ldns\t", cycle / 200);
+        print_self_counters();
+        printf("\n");
 
-    if (second_cpu == - 1) // use the FPGA
-        c2c_data = area + 0x8000000080UL; // addresses of FPGA cache lines
-    else // or another CPU thread
-        c2c_data = area;
-    pthread_barrier_init(&barrier, NULL, second_cpu != -1 ? 3: 2);
-    {
-        pthread_attr_init(&attr);
         CPU_ZERO(&cpus);
-        CPU_SET(first_cpu, &cpus);
-        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
-        pthread_create(tids, &attr, thread_c2c_1, NULL);
-        pthread_attr_destroy(&attr);
+        CPU_SET(cpu_list[0], &cpus);
+        assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first core
+        printf("Memory latency: ");
+        do_seq_latency_test(26); // 64MB
     }
-    if (second_cpu != -1) {
-        pthread_attr_init(&attr);
+
+    if (do_throughput) {
+        uint64_t s;
+
+        for (i = sweep_first(); i <= sweep_last(25); i++) { // from 16kiB to 32MiB by default
+            area_test_size = 1UL << i;
+            itn = i > 22 ? 1: 1 << (22 - i);
+            printf("Size: %s\t", nice_size(area_test_size));
+            fflush(stdout);
+
+            s = start_threads(no_threads, thread_write_cache_area);
+            printf("write %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+            print_counters(no_threads);
+            fflush(stdout);
+
+            s = start_threads(no_threads, thread_clear_cache_area);
+            printf("clear %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+            print_counters(no_threads);
+            fflush(stdout);
+
+            s = start_threads(no_threads, thread_read_cache_area);
+            printf("read %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * no_threads * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+            print_counters(no_threads);
+
+            printf("\n");
+        }
+    }
+    if (do_mix) {
+        uint64_t s, n;
+
+        for (n = 1; n <= no_threads; n = next_thread_count(n, no_threads)) {
+            printf("Read/write mix %d:%d, %ld thread(s)\n", mix_reads, mix_writes, n);
+            for (i = sweep_first(); i <= sweep_last(25); i++) { // from 16kiB to 32MiB by default
+                area_test_size = 1UL << i;
+                itn = i > 22 ? 1: 1 << (22 - i);
+                printf("Size: %s\t", nice_size(area_test_size));
+                fflush(stdout);
+
+                s = start_threads(n, thread_mix_cache_area);
+                printf("mix %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * n * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+                print_counters(n);
+                fflush(stdout);
+
+                s = start_threads(n, thread_rmw_cache_area);
+                printf("rmw %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * n * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+                print_counters(n);
+                printf("\n");
+            }
+        }
+    }
+    if (do_atomic) {
+        uint64_t s, n;
+
+        printf("Atomic increments, %d shared line(s)\n", atomic_lines);
+        itn = 1;
+        for (n = 1; n <= no_threads; n = next_thread_count(n, no_threads)) {
+            printf("Threads: %ld\t", n);
+            for (atomic_kind = 0; atomic_kind < ATOMIC_KINDS; atomic_kind++) {
+                if (!atomic_supported(atomic_kind)) {
+                    printf("%s n/a\t", atomic_kind_names[atomic_kind]);
+                    continue;
+                }
+                s = start_threads(n, thread_atomic);
+                printf("%s %.1fns/op %.3fMops/s\t", atomic_kind_names[atomic_kind], (double)s / rate / (ATOMIC_OPS * itn),
+                    (double)(ATOMIC_OPS * itn * n) * rate * 1000.0 / s);
+                print_counters(n);
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+    }
+    if (do_copy) {
+        const char *mem_name = area_name;
+        uint64_t s, n, d;
+
+        for (d = 0; d < 3; d++) {
+            switch (d) {
+            case 0:
+                copy_src = dram_area;
+                copy_dst = area;
+                printf("Copy CPU->%s\n", mem_name);
+                break;
+            case 1:
+                copy_src = area;
+                copy_dst = dram_area;
+                printf("Copy %s->CPU\n", mem_name);
+                break;
+            default:
+                copy_src = area;
+                copy_dst = area + copy_size;
+                printf("Copy %s->%s\n", mem_name, mem_name);
+                break;
+            }
+            for (n = 1; n <= no_threads; n = next_thread_count(n, no_threads)) {
+                printf("Using %ld thread(s)\n", n);
+                for (i = sweep_first(); i <= sweep_last(25); i++) { // from 16kiB to 32MiB by default
+                    area_test_size = 1UL << i;
+                    itn = i > 22 ? 1: 1 << (22 - i);
+                    printf("Size: %s\t", nice_size(area_test_size));
+                    fflush(stdout);
+
+                    for (copy_kernel = 0; copy_kernel < COPY_KERNELS; copy_kernel++) {
+                        s = start_threads(n, thread_copy_area);
+                        printf("%s %s %.3fGB/s\t", copy_kernel_names[copy_kernel], nice_time(s), (double)(area_test_size * n * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
+                        print_counters(n);
+                        fflush(stdout);
+                    }
+                    printf("\n");
+                }
+            }
+        }
+    }
+    if (do_stress)
+        do_stress_test();
+    if (do_cache_to_cache == 2) {
+        printf("Measuring the latency between cores %s", cpu_list_text);
+        if (use_cpu_memory)
+            printf("...\n");
+        else
+            printf(" and the FPGA...\n");
+        do_c2c_matrix(c2c_concurrency);
+    } else if (do_cache_to_cache) {
+        uint64_t cycle;
+
+        printf("Measuring the latency between core %d and ", cpu_list[0]);
+        if (use_cpu_memory)
+            printf("core %d...\n", cpu_list[no_threads - 1]);
+        else
+            printf("the FPGA...\n");
+        cycle = do_c2c_test(cpu_list[0], use_cpu_memory ? (int)cpu_list[no_threads - 1] : -1);
+        printf("Core-2-core (one trip, 3 hops) latency: %ldns\t", cycle / 200);
+        print_self_counters();
+        printf("\n");
+    }
+
+    if (do_latency) {
+        cpu_set_t cpus;
         CPU_ZERO(&cpus);
-        CPU_SET(second_cpu, &cpus);
-        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
-        pthread_create(tids + 1, &attr, thread_c2c_2, NULL);
-        pthread_attr_destroy(&attr);
+        CPU_SET(cpu_list[0], &cpus);
+        assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first core
+        for (i = sweep_first(); i <= sweep_last(26); i++)
+            do_latency_test(i);
     }
-    pthread_barrier_wait(&barrier);
-    pthread_join(tids[0], (void *)&retval);
-    if (second_cpu != -1) {
-        pthread_join(tids[1], NULL);
+
+    if (do_seq_latency) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu_list[0], &cpus);
+        assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first core
+        for (i = sweep_first(); i <= sweep_last(26); i++)
+            do_seq_latency_test(i);
     }
-    pthread_barrier_destroy(&barrier);
 
-    return retval;
-}
+    if (do_tlb)
+        do_tlb_test();
+    if (do_stride)
+        do_stride_sweep();
+
+    if (do_cmo)
+        do_cmo_test();
+
+    if (do_ring)
+        do_ring_test();
+
+    if (do_scaling)
+        do_scaling_sweep();
 
+    if (do_prefetch_tuning_mode)
+        do_prefetch_tuning(prefetch_profile_out);
+}
 
 int main(int argc, char *argv[])
 {
-    uint64_t i, o;
+    static const struct option long_options[] = {
+        {"cpus", required_argument, NULL, 'C'},
+        {NULL, 0, NULL, 0}
+    };
+    unsigned first_cpu, last_cpu;
+    uint64_t i, o, needed;
     uint64_t ts[4];
     int opt;
     struct timespec tspec[2];
@@ -516,16 +3001,21 @@ int main(int argc, char *argv[])
 
     first_cpu = 0;
     last_cpu = 0;
+    no_threads = 0;
     do_overall = 0;
     do_cache_to_cache = 0;
     do_latency = 0;
     do_throughput = 0;
     use_cpu_memory = 0;
     do_stress = 0;
-    while ((opt = getopt(argc, argv, "hbf:l:stmcpr:")) != -1) {
+    do_copy = 0;
+    do_perf = 0;
+    do_stride = 0;
+    do_tlb = 0;
+    while ((opt = getopt_long(argc, argv, "hbf:l:C:stSumgw:a:kq:T:F:ycx:pM:A:R:Pr:i:d:o:", long_options, NULL)) != -1) {
         switch(opt) {
         case 'h': // print help
-            puts("Usage: mb_enzian [-h] [-f first_core_no] [-l last_core_no] [-s] [-t] [-m] [-c] [-p] [-r stress_type]");
+            puts("Usage: mb_enzian [-h] [-f first_core_no] [-l last_core_no] [-C|--cpus core_list] [-s] [-t] [-S] [-u] [-m] [-g] [-w reads:writes] [-a lines] [-k] [-q depth[:batch[:producers]]] [-T profile] [-F profile] [-y] [-c] [-x concurrency] [-p] [-M backend] [-A area_size] [-R min_size:max_size] [-P] [-r stress_type] [-i interval] [-d duration] [-o output]");
             puts("-h");
             puts("      Print this help");
             puts("-b");
@@ -534,23 +3024,83 @@ int main(int argc, char *argv[])
             puts("      Number of the first core used, 0 (1st core) by default");
             puts("-l last_core_no");
             puts("      Number of the first core used, 0 (1st core) by default");
+            puts("-C|--cpus core_list");
+            puts("      List of the cores used, e.g. 0-7,16,32-47, overrides -f and -l");
             puts("-s");
             puts("      Perform a sequential latency test (only reads)");
             puts("-t");
             puts("      Perform a chaising-pointer latency test (writes and reads)");
+            puts("-S");
+            puts("      Perform a stride sweep: latency and bandwidth for strides from 64B to 1GB and working sets");
+            puts("      from 16KB to the whole backend. Give several backends with -M to sweep the page size.");
+            puts("-u");
+            puts("      Inspect the TLBs: the uTLB and MTLB entries by page size after every access pattern, read with");
+            puts("      the fpgamem ioctls, the cost of the TLB ioctls, and the TLB miss latency for 4KB to 1GB strides");
             puts("-m");
             puts("      Perform a memory throughput test");
+            puts("-g");
+            puts("      Perform a scaling sweep: write, clear, read and copy at 1, 2, 4 ... threads, with compact and");
+            puts("      spread placement on the selected cores, from 16KB per thread up to half of the backend,");
+            puts("      print the aggregate and per thread bandwidth, the fairness and the saturation point");
+            puts("-w reads:writes");
+            puts("      Perform a read/write mix test with the ratio of read and written lines, e.g. 3:1,");
+            puts("      and a read-modify-write test, from 1 thread up to the number of selected cores");
+            puts("-a lines");
+            puts("      Perform an atomic increment test (LDADD, CAS and LDXR/STXR) with the threads sharing the lines,");
+            puts("      1 line is the most contended, from 1 thread up to the number of selected cores");
+            puts("-k");
+            puts("      Measure the cost of the cache maintenance: the fpgamem ioctls (fpgamem backend only, the index ones");
+            puts("      on all the ways of the set of every line), dc civac and dc cvac, per line and per range of dirty lines,");
+            puts("      and the reload after it");
+            puts("-q depth[:batch[:producers]]");
+            puts("      Perform a message ring test: the first selected core consumes, the next ones produce");
+            puts("      cache line messages through a ring in the tested memory, depth is a power of 2,");
+            puts("      batch (1 by default) messages are claimed and freed at once, 1 producer by default");
+            puts("-T profile");
+            puts("      Tune the prefetch distances and instructions of the read kernel for every size");
+            puts("      and backend, write the best ones to the profile file (- for none)");
+            puts("-F profile");
+            puts("      Use the prefetch profile written by -T for the read kernel");
+            puts("-y");
+            puts("      Perform a copy throughput test: CPU->FPGA, FPGA->CPU and FPGA->FPGA memory");
+            puts("      for every copy kernel, from 1 thread up to the number of selected cores");
             puts("-c");
             puts("      Perforem a core-to-core latency test");
+            puts("-x concurrency");
+            puts("      Perform a core-to-core latency test for every pair of the selected cores and every core with the FPGA,");
+            puts("      print p50/p90/p99 matrices. With concurrency > 1, up to concurrency pairs run at once.");
             puts("-p");
             puts("      Use the CPU memory instead of the FPGA memory, 1GB huge pages are used.");
             puts("      Allocate them first by executing it as root: 'echo 3 > /sys/devices/system/node/node0/hugepages/hugepages-1048576kB/nr_hugepages'");
+            puts("-M backend");
+            puts("      Memory to test, can be given several times to test each of them in turn:");
+            puts("      fpgamem[:device]      FPGA memory, /dev/fpgamem by default, the default backend");
+            puts("      hugetlb[:2M|1G]       anonymous HugeTLB pages, 1GB by default, same as -p");
+            puts("      memfd[:4K|2M|1G]      memfd, base pages by default");
+            puts("      file:path             shared mapping of a file");
+            puts("      numa:node[:2M|1G]     anonymous memory bound to a NUMA node, transparent huge pages by default");
+            puts("-A area_size");
+            puts("      Size of the area mapped from every backend, e.g. 256G, by default large enough for the tests,");
+            puts("      at least 3GB, and the whole 1TB window for fpgamem, where -c, -x and -q need more than 512GB");
+            puts("-R min_size:max_size");
+            puts("      Range of the sizes per thread of the sweeps, e.g. 16K:64G, checked against the area size.");
+            puts("      By default from 16KB to 32MB for the throughput tests and to 64MB for the latency tests");
+            puts("-P");
+            puts("      Capture hardware performance counters of every worker around the measured loops");
+            puts("      and print their sums next to the throughput results");
             puts("-r stress_type");
             puts("      Stress testing, continuous access using 32MB blocks. The modes are:");
             puts("      w - writing");
             puts("      c - clearing");
             puts("      r - reading");
             puts("      l - sequential latency");
+            puts("-i interval");
+            puts("      Sampling interval of the stress test in seconds, 1 by default");
+            puts("-d duration");
+            puts("      Duration of the stress test in seconds, for ever by default");
+            puts("-o csv:path|json:path|unix:path");
+            puts("      Export the samples of the stress test as CSV or JSON lines, - for the standard output,");
+            puts("      or as JSON lines to the clients of a Unix socket, that get the last 4096 samples first");
             break;
         case 'b':
             do_overall = 1;
@@ -561,20 +3111,114 @@ int main(int argc, char *argv[])
         case 'l': // last cpu
             last_cpu = atoi(optarg);
             break;
+        case 'C': // list of cpus
+            no_threads = parse_cpu_list(optarg, cpu_list);
+            snprintf(cpu_list_text, sizeof(cpu_list_text), "%s", optarg);
+            break;
         case 's': // do the sequential memory latency test
             do_seq_latency = 1;
             break;
         case 't': // do the memory latency test
             do_latency = 1;
             break;
+        case 'u': // do the TLB inspection
+            do_tlb = 1;
+            break;
+        case 'S': // do the stride sweep
+            do_stride = 1;
+            break;
         case 'm': // do the memory throughput test
             do_throughput = 1;
             break;
+        case 'g': // do the scaling sweep
+            do_scaling = 1;
+            break;
+        case 'w': // do the read/write mix test
+            if (sscanf(optarg, "%u:%u", &mix_reads, &mix_writes) != 2 || mix_reads + mix_writes == 0) {
+                fprintf(stderr, "Invalid read:write ratio: %s\n", optarg);
+                exit(1);
+            }
+            do_mix = 1;
+            break;
+        case 'a': // do the atomic test
+            atomic_lines = atoi(optarg);
+            if (atomic_lines == 0)
+                atomic_lines = 1;
+            do_atomic = 1;
+            break;
+        case 'k': // do the cache maintenance test
+            do_cmo = 1;
+            break;
+        case 'q': // do the ring test
+            if (sscanf(optarg, "%u:%u:%u", &ring_depth, &ring_batch, &ring_producers) < 1 ||
+                ring_depth == 0 || (ring_depth & (ring_depth - 1)) || ring_batch == 0 || ring_batch > ring_depth || ring_producers == 0) {
+                fprintf(stderr, "Invalid ring parameters: %s\n", optarg);
+                exit(1);
+            }
+            do_ring = 1;
+            break;
+        case 'T': // tune the prefetching
+            do_prefetch_tuning_mode = 1;
+            if (strcmp(optarg, "-")) {
+                prefetch_profile_out = fopen(optarg, "w");
+                if (!prefetch_profile_out) {
+                    perror(optarg);
+                    exit(1);
+                }
+            }
+            break;
+        case 'F': // prefetch profile
+            load_prefetch_profile(optarg);
+            break;
+        case 'y': // do the copy throughput test
+            do_copy = 1;
+            break;
         case 'c': // do the core-2-core latency test
             do_cache_to_cache = 1;
             break;
+        case 'x': // do the core-2-core latency matrix
+            c2c_concurrency = atoi(optarg);
+            do_cache_to_cache = 2;
+            break;
         case 'p': // use the CPU memory instead of the FPGA
-            use_cpu_memory = 1;
+            optarg = "hugetlb:1G";
+            // fall through
+        case 'M': // memory backend
+            if (no_backends == MAX_BACKENDS) {
+                fprintf(stderr, "Too many memory backends\n");
+                exit(1);
+            }
+            parse_backend(optarg, backends + no_backends++);
+            break;
+        case 'A': // area size
+            area_size = parse_size(optarg);
+            break;
+        case 'R': { // sweep range
+            const char *max = strchr(optarg, ':');
+
+            sweep_min = parse_size(optarg);
+            sweep_max = max ? parse_size(max + 1) : sweep_min;
+            if (sweep_min < 4096 || sweep_max < sweep_min) {
+                fprintf(stderr, "Invalid size range: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        }
+        case 'P': // capture performance counters
+            do_perf = 1;
+            break;
+        case 'i': // stress sampling interval
+            stress_interval = atof(optarg);
+            if (stress_interval <= 0) {
+                fprintf(stderr, "Invalid interval: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd': // stress duration
+            stress_duration = atof(optarg);
+            break;
+        case 'o': // stress samples output
+            parse_stress_sink(optarg);
             break;
         case 'r': // stress test
             if (optarg[0] == 'w')
@@ -592,163 +3236,109 @@ int main(int argc, char *argv[])
             assert(0);
         }
     }
-// L2 cache size per thread
-    l2_cache_size = 16777216 / (last_cpu - first_cpu + 1);
-// calibrate TSC
-    ts[0] = now();
-    clock_gettime(CLOCK_MONOTONIC_RAW, tspec);
-    usleep(100000);
-    ts[1] = now();
-    clock_gettime(CLOCK_MONOTONIC_RAW, tspec + 1);
-    i = ts[1] - ts[0];
-    o = (tspec[1].tv_sec - tspec[0].tv_sec) * 1000000000 + tspec[1].tv_nsec - tspec[0].tv_nsec;
-    rate = (double)i / o;
-//    printf("tsc diff:%zd  clock diff:%zd  rate:%g  no cpus:%zd\n", i, o, rate, no_cpus);
-
-    if (use_cpu_memory == 0) { // use FPGA mem
-        int fd;
-        void *virt_addr;
-
-        fd = open("/dev/fpgamem", O_RDWR);
-        assert(fd >= 0);
-        virt_addr = (void *)0x100000000000UL; // 1TB aligned, same as the physical FPGA memory address for convenience
-        area = mmap(virt_addr, 0x10000000000UL, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0); // map 1TB
-    } else { // use CPU mem, allocate 3GB, 64MB for 48 threads, use HugeTLB 1GB pages
-        area = mmap(NULL, SIZE * 48, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0); // CPU mem
-        if (area == MAP_FAILED) {
-            fprintf(stderr, "mmap failed. Maybe there's no enough free 1GB huge pages.\n");
-            exit(1);
-        }
-    }
-    assert(area != MAP_FAILED);
-
-    if (do_throughput || do_stress) {
-        printf("Using %d thread(s), from CPU %d to CPU %d...\n", last_cpu - first_cpu + 1, first_cpu, last_cpu);
-    }
-
-// Touch and do the actual mapping of the test area
-    ((uint8_t *)area)[0] = 0;           // 1st GB
-    ((uint8_t *)area)[0x40000000] = 0;  // 2nd GB
-    ((uint8_t *)area)[0x80000000] = 0;  // 3rd GB
-
     if (do_overall) { // use 2 threads
-        uint64_t s;
-        uint64_t cycle;
-        cpu_set_t cpus;
-
         first_cpu = 0;
         last_cpu = 1;
-        area_test_size = 1 << 25; // 32MB
-        itn = 1;
-
-        printf("Throughput:\t");
-        fflush(stdout);
-
-        s = start_threads(first_cpu, last_cpu, thread_write_cache_area);
-        printf("write %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-        fflush(stdout);
-
-        s = start_threads(first_cpu, last_cpu, thread_clear_cache_area);
-        printf("clear %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-        fflush(stdout);
-
-        s = start_threads(first_cpu, last_cpu, thread_read_cache_area);
-        printf("read %s %.3fGB/s\n", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-
-        cycle = do_c2c_test(first_cpu, use_cpu_memory ? last_cpu : -1);
-        printf("Core-2-core (one trip, 3 hops) latency is %ldns\n", cycle / 200);
-
-        CPU_ZERO(&cpus);
-        CPU_SET(first_cpu, &cpus);
-        assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first_cpu core
-        printf("Memory latency: ");
-        do_seq_latency_test(26); // 64MB
+        no_threads = 0;
     }
-
-    if (do_throughput) {
-        uint64_t s;
-
-        for (i = 14; i <= 25; i++) { // from 16kiB to 32MiB
-            area_test_size = 1 << i;
-            itn = i > 22 ? 1: 1 << (22 - i);
-            printf("Size: %s\t", nice_size(area_test_size));
-            fflush(stdout);
-
-            s = start_threads(first_cpu, last_cpu, thread_write_cache_area);
-            printf("write %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-            fflush(stdout);
-
-            s = start_threads(first_cpu, last_cpu, thread_clear_cache_area);
-            printf("clear %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-            fflush(stdout);
-
-            s = start_threads(first_cpu, last_cpu, thread_read_cache_area);
-            printf("read %s %.3fGB/s\t", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-
-            printf("\n");
-        }
+    if (no_threads == 0) { // contiguous range
+        snprintf(cpu_list_text, sizeof(cpu_list_text), "%d-%d", first_cpu, last_cpu);
+        no_threads = parse_cpu_list(cpu_list_text, cpu_list);
     }
-    if (do_stress) {
-        uint64_t s;
-        cpu_set_t cpus;
-
-        puts("Stressing...");
-        area_test_size = 1 << 25; // 32MiB
-        itn = 100;
-        for (;;) {
-            switch (do_stress) {
-                case 1:
-                    s = start_threads(first_cpu, last_cpu, thread_write_cache_area);
-                    printf("write %s %.3fGB/s\n", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-                    break;
-                case 2:
-                    s = start_threads(first_cpu, last_cpu, thread_clear_cache_area);
-                    printf("clear %s %.3fGB/s\n", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-                    break;
-                case 3:
-                    s = start_threads(first_cpu, last_cpu, thread_read_cache_area);
-                    printf("read %s %.3fGB/s\n", nice_time(s), (double)(area_test_size * (last_cpu - first_cpu + 1) * itn) * rate * 1000000000.0 / s / 1048576.0 / 1024.0);
-                    break;
-                default: // 4
-                    CPU_ZERO(&cpus);
-                    CPU_SET(first_cpu, &cpus);
-                    assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first_cpu core
-                    do_seq_latency_test(0);
-                    break;
-            }
-        }
+    detect_topology();
+// Last level cache size per thread, shared between the selected cores sharing it
+    for (i = o = 0; i < no_threads; i++)
+        o += CPU_ISSET(cpu_list[i], &llc_cpus) != 0;
+    l2_cache_size = llc_size / (o ? o : 1);
+    if (counter_freq) { // the architected counter
+        rate = (double)counter_freq / 1000000000.0;
+    } else { // calibrate TSC
+        ts[0] = now();
+        clock_gettime(CLOCK_MONOTONIC_RAW, tspec);
+        usleep(100000);
+        ts[1] = now();
+        clock_gettime(CLOCK_MONOTONIC_RAW, tspec + 1);
+        i = ts[1] - ts[0];
+        o = (tspec[1].tv_sec - tspec[0].tv_sec) * 1000000000 + tspec[1].tv_nsec - tspec[0].tv_nsec;
+        rate = (double)i / o;
     }
-    if (do_cache_to_cache) {
-        uint64_t cycle;
-
-        printf("Measuring the latency between core %d and ", first_cpu);
-        if (use_cpu_memory)
-            printf("core %d...\n", last_cpu);
+//    printf("tsc diff:%zd  clock diff:%zd  rate:%g  no cpus:%zd\n", i, o, rate, no_cpus);
+    if (cpu_ghz == 0) // no cpufreq, ThunderX runs at 2GHz, the TSC at about the nominal clock
+#ifdef __aarch64__
+        cpu_ghz = 2.0;
+#else
+        cpu_ghz = rate;
+#endif
+    printf("Topology: line %ldB  zva %ldB  L1 %s  L%d %s shared by %d core(s)  counter %.1fMHz  core %.2fGHz\n",
+        line_size, zva_size, nice_size(l1_cache_size), llc_level, nice_size(llc_size), CPU_COUNT(&llc_cpus),
+        rate * 1000.0, cpu_ghz);
+
+    if (no_backends == 0) // FPGA memory by default
+        parse_backend("fpgamem", backends + no_backends++);
+
+// Size the backends, the largest sweep size for all the threads, twice for the copies
+    copy_size = (1UL << sweep_last(25)) * no_threads;
+    needed = (1UL << sweep_last(26)) * no_threads;
+    if (do_copy && needed < 2 * copy_size)
+        needed = 2 * copy_size;
+    if (do_scaling && sweep_max) // the scaling sweep stops at half of the area otherwise
+        needed = 2 * needed;
+    for (i = 0; i < no_backends; i++) {
+        struct backend *b = backends + i;
+
+        if (area_size)
+            b->used = area_size;
         else
-            printf("the FPGA...\n");
-        cycle = do_c2c_test(first_cpu, use_cpu_memory ? last_cpu : -1);
-        printf("Core-2-core (one trip, 3 hops) latency: %ldns\n", cycle / 200);
+            b->used = needed > CPU_MEMORY_SIZE ? (needed + (1UL << 30) - 1) & ~((1UL << 30) - 1) : CPU_MEMORY_SIZE;
+        if (b->type == BACKEND_FPGAMEM) { // the whole window unless smaller
+            b->size = area_size && area_size < FPGA_MEMORY_SIZE ? area_size : FPGA_MEMORY_SIZE;
+            if (b->used > b->size)
+                b->used = b->size;
+        } else {
+            b->size = b->used;
+        }
+        if (b->page_size && (b->size & (b->page_size - 1)))
+            b->size = (b->size + b->page_size - 1) & ~(b->page_size - 1);
+        if (b->page_size && (b->used & (b->page_size - 1)))
+            b->used = (b->used + b->page_size - 1) & ~(b->page_size - 1);
+        if (b->used < needed) {
+            fprintf(stderr, "%s: %s is not enough for %s per thread for %d thread(s)\n", b->spec, nice_size(b->used),
+                nice_size(1UL << sweep_last(26)), no_threads);
+            exit(1);
+        }
+        if (b->type == BACKEND_FPGAMEM && (do_cache_to_cache || do_ring) && b->size < C2C_FPGA_LINES + 2 * line_size) {
+            fprintf(stderr, "%s: %s does not reach the FPGA lines of -c, -x and -q at %#lx\n", b->spec,
+                nice_size(b->size), C2C_FPGA_LINES);
+            exit(1);
+        }
     }
 
-    if (do_latency) {
-        cpu_set_t cpus;
-        CPU_ZERO(&cpus);
-        CPU_SET(first_cpu, &cpus);
-        assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first_cpu core
-        for (i = 14; i <= 26; i++)
-            do_latency_test(i);
+    if (do_copy) { // the other side of the copy, use HugeTLB 1GB pages if possible
+        dram_area = mmap(NULL, copy_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        if (dram_area == MAP_FAILED) {
+            fprintf(stderr, "Not enough free 1GB huge pages for the copy test, using transparent huge pages.\n");
+            dram_area = mmap(NULL, copy_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            assert(dram_area != MAP_FAILED);
+            madvise(dram_area, copy_size, MADV_HUGEPAGE);
+        }
+        memset(dram_area, 0, copy_size);
     }
 
-    if (do_seq_latency) {
-        cpu_set_t cpus;
-        CPU_ZERO(&cpus);
-        CPU_SET(first_cpu, &cpus);
-        assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0); // bind to the first_cpu core
-        for (i = 14; i <= 26; i++)
-            do_seq_latency_test(i);
+    if (do_throughput || do_stress || do_copy) {
+        printf("Using %d thread(s), on CPUs %s...\n", no_threads, cpu_list_text);
+    }
+    start_pool();
+    for (i = 0; i < no_backends; i++) {
+        map_backend(backends + i);
+        run_tests();
+        unmap_backend(backends + i);
     }
 
-    munmap(area, SIZE * no_cpus);
+    stop_pool();
+    if (dram_area)
+        munmap(dram_area, copy_size);
+    if (prefetch_profile_out)
+        fclose(prefetch_profile_out);
 //    printf("Bye!\n");
     return 0;
 }
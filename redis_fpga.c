@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,13 +7,24 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <hiredis/hiredis.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define MAX_COLS 32
+#define MAX_LOAD_THREADS 256
+
+#define REDIS_HOST "127.0.0.1"
+#define REDIS_PORT 6369
 
 typedef struct {
     char name[64];
@@ -30,9 +42,12 @@ static uint8_t* gArenaCur  = NULL;
 static uint8_t* gArenaEnd  = NULL;
 
 static void* fpga_alloc(size_t n) {
+    const size_t ALIGN = 64;
+
     if (!gArenaBase) {
-        // Fallback to normal heap if driver mapping isn't enabled/available
-        void* p = malloc(n);
+        // Fallback to normal heap if driver mapping isn't enabled/available,
+        // with the alignment of the arena
+        void* p = aligned_alloc(ALIGN, (n + (ALIGN - 1)) & ~(ALIGN - 1));
         if (!p) {
             fprintf(stderr, "ERROR: malloc failed (%zu bytes)\n", n);
             exit(1);
@@ -40,7 +55,6 @@ static void* fpga_alloc(size_t n) {
         return p;
     }
 
-    const size_t ALIGN = 64;
     uintptr_t cur = (uintptr_t)gArenaCur;
     uintptr_t aligned = (cur + (ALIGN - 1)) & ~(uintptr_t)(ALIGN - 1);
 
@@ -87,15 +101,10 @@ static void SetupEnzianMemoryMapping(const char* devPath, size_t mapBytes) {
 // Existing logic
 // ============================================================
 
-int gaussian_key(int rows) {
-    static int seeded = 0;
-    if (!seeded) {
-        srand(42);
-        seeded = 1;
-    }
-
-    double u1 = (rand() + 1.0) / (RAND_MAX + 1.0);
-    double u2 = (rand() + 1.0) / (RAND_MAX + 1.0);
+// Gaussian key around the middle of the rows, seed is the state of the caller's generator
+int gaussian_key(int rows, unsigned *seed) {
+    double u1 = (rand_r(seed) + 1.0) / (RAND_MAX + 1.0);
+    double u2 = (rand_r(seed) + 1.0) / (RAND_MAX + 1.0);
     double z  = sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
 
     int key = (int)(rows / 2.0 + (rows / 6.0) * z);
@@ -111,54 +120,657 @@ long long now_us() {
 }
 
 // ------------------------------------------------------------
-// Read entire file into a buffer (FPGA-mapped if available)
-// and parse CSV from that buffer.
+// Streaming ingest: the file is read in chunks into two buffers (FPGA-mapped
+// if available), the next chunk is read by a thread while the current one is
+// parsed and loaded. The partial record at the end of a chunk is carried over
+// into the headroom in front of the next one, so memory use is bounded by
+// the two buffers whatever the size of the file.
 // ------------------------------------------------------------
-static char* read_file_into_buffer(const char* path, size_t* out_size) {
-    struct stat st;
-    if (stat(path, &st) != 0) {
-        perror("stat(dataset) failed");
-        return NULL;
+static size_t gChunkBytes = 256UL << 20;
+#define CARRY_HEADROOM(chunk) ((chunk) / 4) // longest record carried over
+
+typedef struct {
+    int fd;
+    char *dst;
+    size_t size;
+    off_t off;
+    ssize_t got;            // -1 on error
+} ChunkRead;
+
+static void* read_chunk_thread(void *arg) {
+    ChunkRead *r = (ChunkRead*)arg;
+
+    // read ahead the chunk after this one
+    posix_fadvise(r->fd, r->off + r->size, r->size, POSIX_FADV_WILLNEED);
+    r->got = 0;
+    while ((size_t)r->got < r->size) {
+        ssize_t n = pread(r->fd, r->dst + r->got, r->size - r->got, r->off + r->got);
+        if (n < 0) {
+            perror("read(dataset) failed");
+            r->got = -1;
+            break;
+        }
+        if (n == 0) break;
+        r->got += n;
+    }
+    return NULL;
+}
+
+// ------------------------------------------------------------
+// CSV tokenizer: one pass over the bytes finds the structural characters
+// (newline, comma, quote) of every 64-byte block as bitmasks, with NEON,
+// SSE2 or scalar code, and the records come out as field offsets and lengths.
+// Quoted fields follow RFC 4180: commas and newlines inside quotes are data,
+// "" is a quote. The quotes are stripped and "" unescaped in place.
+// ------------------------------------------------------------
+typedef struct {
+    uint32_t off[MAX_COLS];     // from the start of the record
+    uint32_t len[MAX_COLS];
+    int n;                      // fields in the record, only MAX_COLS are kept
+} CsvRecord;
+
+typedef struct {
+    char *base;                 // current 64-byte block
+    char *end;
+    uint64_t pending;           // structural characters of the block not consumed yet
+    char *pos;                  // start of the next record
+} CsvReader;
+
+#if defined(__aarch64__)
+static inline uint64_t csv_movemask(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d) {
+    const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t s0 = vpaddq_u8(vandq_u8(a, bits), vandq_u8(b, bits));
+    uint8x16_t s1 = vpaddq_u8(vandq_u8(c, bits), vandq_u8(d, bits));
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+#endif
+
+// Structural characters of 64 bytes, bit i for p[i]
+static inline uint64_t csv_block_mask(const char *p) {
+#if defined(__aarch64__)
+    uint8x16_t v0 = vld1q_u8((const uint8_t*)p);
+    uint8x16_t v1 = vld1q_u8((const uint8_t*)p + 16);
+    uint8x16_t v2 = vld1q_u8((const uint8_t*)p + 32);
+    uint8x16_t v3 = vld1q_u8((const uint8_t*)p + 48);
+    const uint8x16_t nl = vdupq_n_u8('\n'), comma = vdupq_n_u8(','), quote = vdupq_n_u8('"');
+#define CSV_MATCH(v) vorrq_u8(vorrq_u8(vceqq_u8(v, nl), vceqq_u8(v, comma)), vceqq_u8(v, quote))
+    return csv_movemask(CSV_MATCH(v0), CSV_MATCH(v1), CSV_MATCH(v2), CSV_MATCH(v3));
+#undef CSV_MATCH
+#elif defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n'), comma = _mm_set1_epi8(','), quote = _mm_set1_epi8('"');
+    uint64_t m = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+        __m128i e = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, comma)), _mm_cmpeq_epi8(v, quote));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(e) << (16 * i);
     }
+    return m;
+#else
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i++)
+        if (p[i] == '\n' || p[i] == ',' || p[i] == '"')
+            m |= 1ULL << i;
+    return m;
+#endif
+}
 
-    size_t sz = (size_t)st.st_size;
-    FILE* fp = fopen(path, "rb");
-    if (!fp) {
-        perror("Dataset open failed");
+// Mask of the block at base, the last partial block is read through a padded copy
+static inline uint64_t csv_mask_at(const char *base, const char *end) {
+    if (end - base >= 64) return csv_block_mask(base);
+    char tail[64] = {0};
+    memcpy(tail, base, end - base);
+    return csv_block_mask(tail);
+}
+
+static void csv_init(CsvReader *r, char *begin, char *end) {
+    r->base = begin;
+    r->end = end;
+    r->pos = begin;
+    r->pending = begin < end ? csv_mask_at(begin, end) : 0;
+}
+
+// Next structural character at or after the reader position, NULL at the end
+static inline char* csv_next_structural(CsvReader *r) {
+    while (!r->pending) {
+        r->base += 64;
+        if (r->base >= r->end) {
+            r->base = r->end;
+            return NULL;
+        }
+        r->pending = csv_mask_at(r->base, r->end);
+    }
+    char *p = r->base + __builtin_ctzll(r->pending);
+    r->pending &= r->pending - 1;
+    return p;
+}
+
+// Strip the quotes of a field and unescape "" in place, trim the CR of a CRLF
+static void csv_finish_field(CsvRecord *rec, char *rs, char *fs, char *fe, int quotes, int eol) {
+    if (eol && fe > fs && fe[-1] == '\r') fe--;
+    if (quotes && *fs == '"') {
+        char *q = fe - 1;
+        while (q > fs && *q != '"') q--;
+        fe = q > fs ? q : fe;               // up to the closing quote, anything after it is dropped
+        fs++;
+        if (quotes > 2) { // "" inside
+            char *w = fs;
+            for (char *s = fs; s < fe; s++) {
+                *w++ = *s;
+                if (*s == '"' && s + 1 < fe && s[1] == '"') s++;
+            }
+            fe = w;
+        }
+    }
+    if (rec->n < MAX_COLS) {
+        rec->off[rec->n] = fs - rs;
+        rec->len[rec->n] = fe - fs;
+    }
+    rec->n++;
+}
+
+// Parse the next record, returns its start or NULL at the end
+// An empty line is a record of one empty field
+static char* csv_next_record(CsvReader *r, CsvRecord *rec) {
+    char *rs = r->pos, *fs = rs, *p;
+    int in_quotes = 0, quotes = 0;
+
+    if (rs >= r->end) return NULL;
+    rec->n = 0;
+    while ((p = csv_next_structural(r)) != NULL) {
+        if (p < rs) continue; // consumed by an earlier record
+        if (*p == '"') {
+            in_quotes = !in_quotes;
+            quotes++;
+        } else if (!in_quotes) {
+            csv_finish_field(rec, rs, fs, p, quotes, *p == '\n');
+            fs = p + 1;
+            quotes = 0;
+            if (*p == '\n') {
+                r->pos = p + 1;
+                return rs;
+            }
+        }
+    }
+    csv_finish_field(rec, rs, fs, r->end, quotes, 1);
+    r->pos = r->end;
+    return rs;
+}
+
+static inline int csv_empty(const CsvRecord *rec) {
+    return rec->n == 1 && rec->len[0] == 0;
+}
+
+// Split [begin, end) into n chunks of whole records of about the same size,
+// bounds[i] is the end of chunk i, one pass for the quotes
+static void csv_split(char *begin, char *end, int n, char **bounds) {
+    CsvReader r;
+    char *s;
+    int in_quotes = 0, i = 0;
+    size_t size = end - begin;
+
+    csv_init(&r, begin, end);
+    while (i < n - 1 && (s = csv_next_structural(&r)) != NULL) {
+        if (*s == '"')
+            in_quotes = !in_quotes;
+        else if (*s == '\n' && !in_quotes)
+            while (i < n - 1 && s + 1 >= begin + size * (i + 1) / n)
+                bounds[i++] = s + 1;
+    }
+    while (i < n)
+        bounds[i++] = end;
+}
+
+// End of the last complete record of [begin, end), begin if there is none
+static char* csv_last_record_end(char *begin, char *end) {
+    CsvReader r;
+    char *s, *last = begin;
+    int in_quotes = 0;
+
+    csv_init(&r, begin, end);
+    while ((s = csv_next_structural(&r)) != NULL) {
+        if (*s == '"')
+            in_quotes = !in_quotes;
+        else if (*s == '\n' && !in_quotes)
+            last = s + 1;
+    }
+    return last;
+}
+
+// ------------------------------------------------------------
+// Column cache: the loader also materialises every integer column as a
+// contiguous int64 array in the FPGA arena, 64-byte aligned, with a bitmap
+// of the present values (an empty field or a skipped row is NULL). The
+// scans then aggregate straight from the arrays, without going through Redis.
+// ------------------------------------------------------------
+
+// True if the 8 bytes are all ASCII digits
+static inline int eight_digits(uint64_t v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+// Value of 8 ASCII digits loaded little-endian, the first digit in the low byte
+static inline uint32_t parse_eight_digits(uint64_t v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFFULL;
+    return (uint32_t)((v * 10000 + (v >> 32)) & 0xFFFFFFFFULL);
+}
+
+// [-]digits as loaded, 8 digits per step then one at a time, stops at the first non-digit like atoll
+static inline long long parse_int_fast(const char *s, size_t len) {
+    const char *e = s + len;
+    int neg = len && *s == '-';
+    unsigned long long v = 0;
+    uint64_t w;
+
+    s += neg;
+    while (e - s >= 8) {
+        memcpy(&w, s, 8);
+        if (!eight_digits(w)) break;
+        v = v * 100000000ULL + parse_eight_digits(w);
+        s += 8;
+    }
+    for (; s < e && (unsigned)(*s - '0') < 10; s++)
+        v = v * 10 + (unsigned)(*s - '0');
+    return neg ? -(long long)v : (long long)v;
+}
+
+// COUNT/SUM/MIN/MAX of a column, AVG is sum / count
+typedef struct {
+    long long count, sum, min, max;
+} ColumnAgg;
+
+// Merge a partial aggregate into another one
+static void agg_merge(ColumnAgg *a, const ColumnAgg *b) {
+    if (!b->count) return;
+    if (!a->count || b->min < a->min) a->min = b->min;
+    if (!a->count || b->max > a->max) a->max = b->max;
+    a->count += b->count;
+    a->sum += b->sum;
+}
+
+static void agg_add(ColumnAgg *a, long long v) {
+    ColumnAgg one = {1, v, v, v};
+    agg_merge(a, &one);
+}
+
+static long gColumnCapacity = -1;  // -m, rows, estimated from the file size by default, 0 disables the cache
+
+typedef struct {
+    long cap;               // rows the arrays have room for, a multiple of 64
+    long rows;
+    int overflow;           // more rows than cap, the cache is incomplete and not used
+    int64_t *data[MAX_COLS];    // by schema position, NULL for the string columns
+    uint64_t *valid[MAX_COLS];  // bit i of word i / 64 set if row i + 1 has a value
+} ColumnCache;
+
+static ColumnCache gCache;
+
+static void column_cache_init(const Column *schema, int cols, long cap) {
+    int n = 0;
+
+    memset(&gCache, 0, sizeof(gCache));
+    for (int i = 0; i < cols; i++) n += schema[i].is_int;
+    if (gArenaBase && n && cap > 0) {
+        // what is left of the arena, less the alignment of the 2 arrays per column
+        long room = (long)(gArenaEnd - gArenaCur) - 2L * 64 * n;
+        long fit = room > 0 ? (long)(room / (n * (sizeof(int64_t) + 1.0 / 8))) & ~63L : 0;
+        if (fit < 64) {
+            printf("Column cache: disabled, %ld bytes left in FPGA memory\n", room > 0 ? room : 0);
+            return;
+        }
+        if (cap > fit) {
+            printf("Column cache: %ld rows do not fit in FPGA memory, room for %ld\n", cap, fit);
+            cap = fit;
+        }
+    }
+    gCache.cap = (cap + 63) & ~63L;
+    if (!gCache.cap) return;
+    for (int i = 0; i < cols; i++) {
+        if (!schema[i].is_int) continue;
+        gCache.data[i] = (int64_t*)fpga_alloc(gCache.cap * sizeof(int64_t));
+        gCache.valid[i] = (uint64_t*)fpga_alloc(gCache.cap / 8);
+        memset(gCache.valid[i], 0, gCache.cap / 8);
+    }
+    printf("Column cache: %d integer column(s), room for %ld rows, %.1f MB in %s\n",
+           n, gCache.cap, n * gCache.cap * (sizeof(int64_t) + 1.0 / 8) / (1 << 20),
+           gArenaBase ? "FPGA memory" : "heap");
+}
+
+// Store the integer fields of a row, the threads share the bitmap words at the chunk edges
+static inline void column_cache_row(int row, int cols, const char *rs, const CsvRecord *rec) {
+    long i = row - 1;
+
+    if (!gCache.cap) return;
+    if (i >= gCache.cap) {
+        gCache.overflow = 1;
+        return;
+    }
+    for (int k = 0; k < cols; k++) {
+        if (!gCache.data[k] || rec->len[k] == 0) continue;
+        gCache.data[k][i] = parse_int_fast(rs + rec->off[k], rec->len[k]);
+        __atomic_fetch_or(gCache.valid[k] + (i >> 6), 1ULL << (i & 63), __ATOMIC_RELAXED);
+    }
+}
+
+// ------------------------------------------------------------
+// Pipelined writes: commands are appended with redisAppendCommandArgv,
+// at most `depth` replies are in flight and they are drained `batch` at a time.
+// Every reply remembers its row, errors are reported by row.
+// ------------------------------------------------------------
+#define MAX_REPORTED_ERRORS 16
+
+static int gPipelineDepth = 256;
+
+typedef struct {
+    redisContext *c;
+    int depth;          // replies in flight at most
+    int batch;          // replies drained at once when the pipeline is full
+    int *rows;          // row of every reply in flight, a ring of depth entries
+    int head;           // oldest reply in flight
+    int count;          // replies in flight
+    long long errors;
+    char *enc;          // binary row being encoded, -b
+    size_t enc_cap;
+} Pipeline;
+
+static void pipeline_init(Pipeline *p, redisContext *c, int depth) {
+    p->c = c;
+    p->depth = depth > 0 ? depth : 1;
+    p->batch = p->depth > 1 ? p->depth / 2 : 1;
+    p->rows = (int*)malloc(sizeof(int) * p->depth);
+    if (!p->rows) {
+        fprintf(stderr, "ERROR: malloc failed (pipeline of %d)\n", p->depth);
+        exit(1);
+    }
+    p->head = 0;
+    p->count = 0;
+    p->errors = 0;
+    p->enc = NULL;
+    p->enc_cap = 0;
+}
+
+// Wait for the n oldest replies, returns -1 if the connection failed
+static int pipeline_drain(Pipeline *p, int n) {
+    while (n-- > 0 && p->count > 0) {
+        redisReply *r = NULL;
+        int row = p->rows[p->head];
+
+        if (redisGetReply(p->c, (void**)&r) != REDIS_OK || !r) {
+            fprintf(stderr, "ERROR: row %d: %s\n", row, p->c->errstr);
+            return -1;
+        }
+        if (r->type == REDIS_REPLY_ERROR) {
+            if (p->errors < MAX_REPORTED_ERRORS)
+                fprintf(stderr, "ERROR: row %d: %s\n", row, r->str);
+            p->errors++;
+        }
+        freeReplyObject(r);
+        p->head = (p->head + 1) % p->depth;
+        p->count--;
+    }
+    return 0;
+}
+
+// Queue a command for a row, draining a batch first if the pipeline is full
+static int pipeline_append(Pipeline *p, int row, int argc, const char **argv, const size_t *argvlen) {
+    if (p->count == p->depth && pipeline_drain(p, p->batch) != 0)
+        return -1;
+    if (redisAppendCommandArgv(p->c, argc, argv, argvlen) != REDIS_OK) {
+        fprintf(stderr, "ERROR: row %d: %s\n", row, p->c->errstr);
+        return -1;
+    }
+    p->rows[(p->head + p->count) % p->depth] = row;
+    p->count++;
+    return 0;
+}
+
+// Drain everything, returns the number of failed commands or -1
+static long long pipeline_finish(Pipeline *p) {
+    int r = pipeline_drain(p, p->count);
+
+    free(p->rows);
+    p->rows = NULL;
+    free(p->enc);
+    p->enc = NULL;
+    if (p->errors > MAX_REPORTED_ERRORS)
+        fprintf(stderr, "ERROR: %lld failed commands in total\n", p->errors);
+    return r != 0 ? -1 : p->errors;
+}
+
+// ------------------------------------------------------------
+// Binary rows (-b): every row is also stored as one string, rowb:N, laid out
+// as a bitmap of the NULL columns, one 8-byte slot per column, then the bytes
+// of the strings. An integer slot holds the int64, a string slot the offset
+// and the length of its bytes, both uint32. Everything is little-endian, the
+// readers decode in place in the reply without copying or parsing.
+// ------------------------------------------------------------
+static bool gBinaryRows = false;
+
+#define ROWB_SLOT(k) (8 + 8 * (size_t)(k))
+
+static inline int rowb_null(const char *b, int k) {
+    uint64_t nulls;
+    memcpy(&nulls, b, 8);
+    return (nulls >> k) & 1;
+}
+
+static inline int64_t rowb_int(const char *b, int k) {
+    int64_t v;
+    memcpy(&v, b + ROWB_SLOT(k), 8);
+    return v;
+}
+
+static inline const char* rowb_str(const char *b, int k, uint32_t *len) {
+    uint32_t off;
+    memcpy(&off, b + ROWB_SLOT(k), 4);
+    memcpy(len, b + ROWB_SLOT(k) + 4, 4);
+    return b + off;
+}
+
+// Encode a row into p->enc, returns its length
+static size_t rowb_encode(Pipeline *p, Column *schema, int cols, const char *rs, const CsvRecord *rec) {
+    size_t need = ROWB_SLOT(cols);
+    for (int i = 0; i < cols; i++)
+        if (!schema[i].is_int) need += rec->len[i];
+    if (need > p->enc_cap) {
+        p->enc_cap = need * 2;
+        p->enc = (char*)realloc(p->enc, p->enc_cap);
+        if (!p->enc) {
+            fprintf(stderr, "ERROR: malloc failed (%zu bytes)\n", p->enc_cap);
+            exit(1);
+        }
+    }
+
+    uint64_t nulls = 0;
+    uint32_t off = ROWB_SLOT(cols);
+    for (int i = 0; i < cols; i++) {
+        char *slot = p->enc + ROWB_SLOT(i);
+        if (schema[i].is_int) {
+            int64_t v = rec->len[i] ? parse_int_fast(rs + rec->off[i], rec->len[i]) : 0;
+            if (!rec->len[i]) nulls |= 1ULL << i;
+            memcpy(slot, &v, 8);
+        } else {
+            uint32_t len = rec->len[i];
+            memcpy(slot, &off, 4);
+            memcpy(slot + 4, &len, 4);
+            memcpy(p->enc + off, rs + rec->off[i], len);
+            off += len;
+        }
+    }
+    memcpy(p->enc, &nulls, 8);
+    return off;
+}
+
+// One multi-field HSET for a row, key row:<row>, the fields in schema order
+static int append_row(Pipeline *p, int row, Column *schema, int cols, const char *rs, const CsvRecord *rec) {
+    const char *argv[2 + 2 * MAX_COLS];
+    size_t argvlen[2 + 2 * MAX_COLS];
+    char key[64];
+    int argc = 0;
+
+    argvlen[argc] = 4;
+    argv[argc++] = "HSET";
+    argvlen[argc] = snprintf(key, sizeof(key), "row:%d", row);
+    argv[argc++] = key;
+    for (int i = 0; i < cols; i++) {
+        argvlen[argc] = strlen(schema[i].name);
+        argv[argc++] = schema[i].name;
+        argvlen[argc] = rec->len[i];
+        argv[argc++] = rs + rec->off[i];
+    }
+    if (pipeline_append(p, row, argc, argv, argvlen) != 0)
+        return -1;
+    if (!gBinaryRows)
+        return 0;
+
+    argv[0] = "SET";
+    argvlen[0] = 3;
+    argvlen[1] = snprintf(key, sizeof(key), "rowb:%d", row);
+    argvlen[2] = rowb_encode(p, schema, cols, rs, rec);
+    argv[2] = p->enc;
+    return pipeline_append(p, row, 3, argv, argvlen);
+}
+
+// ------------------------------------------------------------
+// Parallel loading: the rows after the first one are split at newline boundaries
+// into one chunk per thread, every thread is pinned and has its own connection.
+// The threads count their rows first, so the rows are numbered across the chunks.
+// ------------------------------------------------------------
+static int gLoadThreads = 1;
+
+typedef struct {
+    int id;
+    char *begin, *end;      // the chunk, whole lines
+    int rows;               // non-empty records in the chunk
+    int base_row;           // number of the first row of the first chunk
+    int first_row;          // number of the first one
+    Column *schema;
+    int cols;
+    long long failed;       // failed commands, -1 if the connection failed
+    int unsent;             // rows not sent after a failure
+} LoadChunk;
+
+static pthread_barrier_t gLoadBarrier;
+
+static redisContext* redis_connect(void) {
+    redisContext *c = redisConnect(REDIS_HOST, REDIS_PORT);
+    if (!c || c->err) {
+        fprintf(stderr, "Redis connection error: %s\n", c ? c->errstr : "out of memory");
+        if (c) redisFree(c);
         return NULL;
     }
+    return c;
+}
+
+static void pin_thread(int id) {
+    cpu_set_t cpus;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
 
-    // +1 so we can NUL-terminate for in-place tokenization
-    char* buf = (char*)fpga_alloc(sz + 1);
-    size_t got = fread(buf, 1, sz, fp);
-    fclose(fp);
+    CPU_ZERO(&cpus);
+    CPU_SET(id % (n > 0 ? n : 1), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
 
-    if (got != sz) {
-        fprintf(stderr, "ERROR: fread got %zu bytes, expected %zu\n", got, sz);
+static void* load_chunk_thread(void *arg) {
+    LoadChunk *ch = (LoadChunk*)arg;
+    LoadChunk *chunks = ch - ch->id;
+    CsvReader rd;
+    CsvRecord rec;
+    char *rs;
+
+    pin_thread(ch->id);
+
+    // count the rows of the chunk, then number them after the previous chunks
+    ch->rows = 0;
+    csv_init(&rd, ch->begin, ch->end);
+    while (csv_next_record(&rd, &rec) != NULL)
+        if (!csv_empty(&rec)) ch->rows++;
+    pthread_barrier_wait(&gLoadBarrier);
+    ch->first_row = ch->base_row;
+    for (int i = 0; i < ch->id; i++)
+        ch->first_row += chunks[i].rows;
+
+    redisContext *c = redis_connect();
+    if (!c) {
+        ch->failed = -1;
+        ch->unsent = ch->rows;
         return NULL;
     }
-    buf[sz] = '\0';
-    if (out_size) *out_size = sz;
-    return buf;
-}
-
-// Helper: get next line from an in-memory buffer (in-place, returns pointer to line)
-static char* next_line(char** cursor) {
-    if (!cursor || !*cursor || **cursor == '\0') return NULL;
-    char* start = *cursor;
-    char* nl = strchr(start, '\n');
-    if (nl) {
-        *nl = '\0';
-        *cursor = nl + 1;
-        // Trim possible CR
-        size_t len = strlen(start);
-        if (len && start[len - 1] == '\r') start[len - 1] = '\0';
-        return start;
-    } else {
-        // last line
-        *cursor = start + strlen(start);
-        return start;
+
+    Pipeline pl;
+    pipeline_init(&pl, c, gPipelineDepth);
+
+    int row = ch->first_row - 1;
+    csv_init(&rd, ch->begin, ch->end);
+    while ((rs = csv_next_record(&rd, &rec)) != NULL) {
+        // skip empty lines
+        if (csv_empty(&rec)) continue;
+
+        row++;
+
+        if (rec.n < ch->cols) {
+            fprintf(stderr, "ERROR: row %d: %d of %d columns, skipped\n", row, rec.n, ch->cols);
+            continue;
+        }
+        if (append_row(&pl, row, ch->schema, ch->cols, rs, &rec) != 0) {
+            ch->unsent = ch->first_row + ch->rows - row;
+            break;
+        }
+        column_cache_row(row, ch->cols, rs, &rec);
+    }
+
+    ch->failed = pipeline_finish(&pl);
+    if (ch->unsent) ch->failed = -1;
+    redisFree(c);
+    return NULL;
+}
+
+// Load the records of [begin, end) as rows first_row and on, one chunk per thread
+// Returns the number of rows, -1 if a connection failed, the failed commands are added to *failed
+static int load_rows_parallel(char *begin, char *end, Column *schema, int cols, int first_row, long long *failed) {
+    int nthreads = gLoadThreads;
+    size_t size = end - begin;
+    if ((size_t)nthreads > size / 4096 + 1) nthreads = size / 4096 + 1; // at least a few lines per chunk
+
+    LoadChunk chunks[MAX_LOAD_THREADS];
+    pthread_t threads[MAX_LOAD_THREADS];
+    char *bounds[MAX_LOAD_THREADS];
+    csv_split(begin, end, nthreads, bounds); // at newlines outside quotes
+    for (int i = 0; i < nthreads; i++) {
+        memset(chunks + i, 0, sizeof(chunks[i]));
+        chunks[i].id = i;
+        chunks[i].begin = i ? bounds[i - 1] : begin;
+        chunks[i].end = bounds[i];
+        chunks[i].base_row = first_row;
+        chunks[i].schema = schema;
+        chunks[i].cols = cols;
     }
+
+    int rows = 0;
+    pthread_barrier_init(&gLoadBarrier, NULL, nthreads);
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(threads + i, NULL, load_chunk_thread, chunks + i) != 0) {
+            fprintf(stderr, "ERROR: pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        if (chunks[i].failed < 0) {
+            fprintf(stderr, "ERROR: connection lost while loading rows %d to %d, %d of them sent\n",
+                    chunks[i].first_row, chunks[i].first_row + chunks[i].rows - 1, chunks[i].rows - chunks[i].unsent);
+            rows = -1;
+        } else if (rows >= 0) {
+            rows += chunks[i].rows;
+            *failed += chunks[i].failed;
+        }
+    }
+    pthread_barrier_destroy(&gLoadBarrier);
+    return rows;
 }
 
 int load_dataset_generic(
@@ -167,210 +779,802 @@ int load_dataset_generic(
     Column *schema,
     int *ns
 ) {
-    size_t fsz = 0;
-    char* filebuf = read_file_into_buffer(path, &fsz);
-    if (!filebuf) return 0;
-
-    char* cursor = filebuf;
-    char* line = NULL;
-
-    char *tokens[MAX_COLS];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Dataset open failed");
+        return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // two buffers, each with the headroom for the record carried over in front of the chunk
+    size_t headroom = CARRY_HEADROOM(gChunkBytes);
+    char *bufs[2];
+    for (int i = 0; i < 2; i++)
+        bufs[i] = (char*)fpga_alloc(headroom + gChunkBytes);
+
+    ChunkRead rd_next = {fd, bufs[0] + headroom, gChunkBytes, 0, 0};
+    read_chunk_thread(&rd_next);
+    if (rd_next.got < 0) {
+        close(fd);
+        return 0;
+    }
+    off_t off = rd_next.got;
+    int cur = 0;
+    char* bufbegin = bufs[0] + headroom;
+    char* bufend = bufbegin + rd_next.got;
+    bool last = (size_t)rd_next.got < gChunkBytes;
+
+    CsvReader rd;
+    CsvRecord rec;
+    char* rs;
     int cols = 0;
 
+    csv_init(&rd, bufbegin, last ? bufend : csv_last_record_end(bufbegin, bufend));
+
     /* ---------- HEADER ---------- */
-    line = next_line(&cursor);
-    if (!line) {
+    rs = csv_next_record(&rd, &rec);
+    if (!rs || csv_empty(&rec)) {
         fprintf(stderr, "ERROR: Empty CSV\n");
+        close(fd);
         return 0;
     }
 
-    char* saveptr = NULL;
-    char* tok = strtok_r(line, ",", &saveptr);
-    while (tok && cols < MAX_COLS) {
-        strncpy(schema[cols].name, tok, 63);
-        schema[cols].name[63] = '\0';
+    for (int i = 0; i < rec.n && cols < MAX_COLS; i++) {
+        size_t len = rec.len[i] < 63 ? rec.len[i] : 63;
+        memcpy(schema[cols].name, rs + rec.off[i], len);
+        schema[cols].name[len] = '\0';
         schema[cols].is_int = 1;   // assume int first
         cols++;
-        tok = strtok_r(NULL, ",", &saveptr);
     }
     *ns = cols;
 
     /* ---------- FIRST ROW (TYPE INFERENCE) ---------- */
-    line = next_line(&cursor);
-    if (!line) {
+    while ((rs = csv_next_record(&rd, &rec)) != NULL && csv_empty(&rec))
+        ;
+    if (!rs) {
         fprintf(stderr, "ERROR: CSV has header but no data rows\n");
+        close(fd);
+        return 0;
+    }
+    if (rec.n < cols) {
+        fprintf(stderr, "ERROR: row 1: %d of %d columns\n", rec.n, cols);
+        close(fd);
         return 0;
     }
 
-    saveptr = NULL;
-    tok = strtok_r(line, ",", &saveptr);
-    for (int i = 0; i < cols && tok; i++) {
-        tokens[i] = tok;
-        for (char *p = tok; *p; p++) {
-            if ((*p < '0' || *p > '9') && *p != '-') {
+    for (int i = 0; i < cols; i++) {
+        const char *f = rs + rec.off[i];
+        for (uint32_t j = 0; j < rec.len[i]; j++) {
+            if ((f[j] < '0' || f[j] > '9') && f[j] != '-') {
                 schema[i].is_int = 0;
                 break;
             }
         }
-        tok = strtok_r(NULL, ",", &saveptr);
     }
 
+    /* ---------- COLUMN CACHE ---------- */
+    long cap = gColumnCapacity;
+    if (cap < 0) {
+        // rows in the first MB scaled to the whole file, with a quarter of slack
+        struct stat st;
+        char *sample = bufend - bufbegin > (1 << 20) ? csv_last_record_end(rs, bufbegin + (1 << 20)) : bufend;
+        CsvReader srd;
+        CsvRecord srec;
+        long sampled = 0;
+
+        csv_init(&srd, rs, sample);
+        while (csv_next_record(&srd, &srec) != NULL)
+            if (!csv_empty(&srec)) sampled++;
+        fstat(fd, &st);
+        cap = sample > rs ? (long)((double)st.st_size * sampled / (sample - rs) * 1.25) + 64 : 0;
+    }
+    column_cache_init(schema, cols, cap);
+
     /* ---------- STORE SCHEMA IN REDIS ---------- */
     redisReply* rr = redisCommand(c, "DEL schema");
     if (rr) freeReplyObject(rr);
 
-    for (int i = 0; i < cols; i++) {
-        rr = redisCommand(
-            c,
-            "HSET schema %s %s",
-            schema[i].name,
-            schema[i].is_int ? "int" : "string"
-        );
-        if (rr) freeReplyObject(rr);
+    Pipeline pl;
+    pipeline_init(&pl, c, gPipelineDepth);
+
+    {
+        const char *argv[2 + 2 * MAX_COLS];
+        size_t argvlen[2 + 2 * MAX_COLS];
+        int argc = 0;
+
+        argvlen[argc] = 4;
+        argv[argc++] = "HSET";
+        argvlen[argc] = 6;
+        argv[argc++] = "schema";
+        for (int i = 0; i < cols; i++) {
+            argvlen[argc] = strlen(schema[i].name);
+            argv[argc++] = schema[i].name;
+            argv[argc] = schema[i].is_int ? "int" : "string";
+            argvlen[argc] = strlen(argv[argc]);
+            argc++;
+        }
+        if (pipeline_append(&pl, 0, argc, argv, argvlen) != 0) {
+            pipeline_finish(&pl);
+            close(fd);
+            return 0;
+        }
     }
 
     /* ---------- STORE FIRST ROW ---------- */
     int row = 1;
-    char key[64];
-    snprintf(key, sizeof(key), "row:%d", row);
-
-    for (int i = 0; i < cols; i++) {
-        rr = redisCommand(c, "HSET %s %s %s", key, schema[i].name, tokens[i]);
-        if (rr) freeReplyObject(rr);
+    if (append_row(&pl, row, schema, cols, rs, &rec) != 0) {
+        pipeline_finish(&pl);
+        close(fd);
+        return 0;
     }
+    column_cache_row(row, cols, rs, &rec);
 
-    /* ---------- REMAINING ROWS ---------- */
-    while ((line = next_line(&cursor)) != NULL) {
-        // skip empty lines
-        if (*line == '\0') continue;
-
-        row++;
-        snprintf(key, sizeof(key), "row:%d", row);
+    long long failed = pipeline_finish(&pl);
+    if (failed < 0) {
+        fprintf(stderr, "ERROR: connection lost while loading\n");
+        close(fd);
+        return 0;
+    }
 
-        saveptr = NULL;
-        tok = strtok_r(line, ",", &saveptr);
-        for (int i = 0; i < cols && tok; i++) {
-            rr = redisCommand(c, "HSET %s %s %s", key, schema[i].name, tok);
-            if (rr) freeReplyObject(rr);
-            tok = strtok_r(NULL, ",", &saveptr);
+    /* ---------- REMAINING ROWS, CHUNK BY CHUNK ---------- */
+    long long t1 = now_us();
+    char *cursor = rd.pos;
+    int chunks = 1;
+    for (;;) {
+        pthread_t reader;
+        char *done = last ? bufend : csv_last_record_end(cursor, bufend);
+
+        // read the next chunk while this one is loaded
+        if (!last) {
+            rd_next = (ChunkRead){fd, bufs[!cur] + headroom, gChunkBytes, off, 0};
+            if (pthread_create(&reader, NULL, read_chunk_thread, &rd_next) != 0) {
+                fprintf(stderr, "ERROR: pthread_create failed\n");
+                exit(1);
+            }
         }
+        int n = load_rows_parallel(cursor, done, schema, cols, row + 1, &failed);
+        if (!last)
+            pthread_join(reader, NULL);
+        if (n < 0 || (!last && rd_next.got < 0)) {
+            close(fd);
+            return 0;
+        }
+        row += n;
+        if (last) break;
+
+        // carry the partial record over in front of the next chunk
+        size_t carry = bufend - done;
+        if (carry > headroom) {
+            fprintf(stderr, "ERROR: record at row %d longer than %zu bytes\n", row + 1, headroom);
+            close(fd);
+            return 0;
+        }
+        cur = !cur;
+        bufbegin = bufs[cur] + headroom;
+        cursor = bufbegin - carry;
+        memcpy(cursor, done, carry);
+        bufend = bufbegin + rd_next.got;
+        off += rd_next.got;
+        last = (size_t)rd_next.got < gChunkBytes;
+        chunks++;
     }
+    close(fd);
+    long long t = now_us() - t1;
+    gCache.rows = row;
+    if (gCache.overflow)
+        fprintf(stderr, "WARNING: %d rows, more than the %ld of the column cache, not using it (see -m)\n", row, gCache.cap);
 
-    printf("Loaded %d rows, %d columns\n", row, cols);
+    printf("Loaded %d rows, %d columns (%d chunk(s) of %zu MB, %d thread(s), pipeline depth %d, %lld failed) in %lld us, %.0f rows/s\n",
+           row, cols, chunks, gChunkBytes >> 20, gLoadThreads, gPipelineDepth, failed, t, t ? (row - 1) * 1e6 / t : 0.0);
     return row;
 }
 
-long long query_select_gaussian(redisContext *c, int rows) {
-    long long t1 = now_us();
+// ------------------------------------------------------------
+// Query driver: every connection has its own pinned thread keeping up to
+// `depth` commands in flight in a pipeline, so the numbers show the server
+// capacity rather than the round-trip time. The latency of a command is
+// from its append to its reply, the client-side queueing included.
+// ------------------------------------------------------------
+#define MAX_QUERY_DEPTHS 16
+#define MAX_QUERY_CONNS 256
 
-    for (int i = 0; i < rows; i++) {
-        int id = gaussian_key(rows);
-        char key[64];
-        snprintf(key, sizeof(key), "row:%d", id);
+static int gQueryDepths[MAX_QUERY_DEPTHS] = {1, 16, 128};
+static int gNumQueryDepths = 3;
+static int gQueryConns = 1;
+static const char *gProjection = NULL;  // -p, the integer columns by default
 
-        redisReply *r = redisCommand(c, "HGETALL %s", key);
-        if (r) freeReplyObject(r);
+// Fields a query fetches with HMGET, resolved once from the schema, in reply order
+typedef struct {
+    int n;
+    const char *name[MAX_COLS];
+    size_t len[MAX_COLS];
+    int is_int[MAX_COLS];
+    int col[MAX_COLS];      // position in the schema
+} ColumnMap;
+
+struct QueryThread;
+
+typedef struct {
+    const char *name;
+    // command of the i-th operation of the workload, argv[1] is the key
+    int (*build)(struct QueryThread *t, long i, const char **argv, size_t *argvlen);
+    // accumulate a reply, may be NULL
+    void (*reply)(struct QueryThread *t, redisReply *r);
+} QueryOps;
+
+typedef struct QueryThread {
+    int id;
+    const QueryOps *ops;
+    long first, count;      // operations [first, first + count) of the workload
+    int rows;
+    int depth;
+    const ColumnMap *map;
+    unsigned seed;
+    char key[64];
+    long long sum;          // accumulated by the reply callbacks
+    long rows_seen;
+    ColumnAgg agg[MAX_COLS];
+    long long reply_bytes;
+    char range[2][24];      // argument buffers of the pushdown and of GETRANGE
+    double *lat;            // latency of every operation, us
+    int inexact;            // the pushdown went past 2^53
+    int failed;
+} QueryThread;
+
+typedef struct {
+    long ops;
+    long long total_us;
+    double ops_s, avg_us, p50_us, p99_us;
+    long long sum;
+    long rows_seen;
+    ColumnAgg agg[MAX_COLS];
+    long long reply_bytes;  // RESP size of the replies, what crossed the network
+    int inexact;
+} QueryResult;
+
+static double now_us_f(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Bytes of a reply in RESP2, as sent by the server
+static long long resp_size(const redisReply *r) {
+    char num[24];
+    long long n;
+
+    switch (r->type) {
+    case REDIS_REPLY_ARRAY:
+        n = 3 + snprintf(num, sizeof(num), "%zu", r->elements);
+        for (size_t i = 0; i < r->elements; i++) n += resp_size(r->element[i]);
+        return n;
+    case REDIS_REPLY_STRING:
+        return 5 + snprintf(num, sizeof(num), "%zu", r->len) + r->len;
+    case REDIS_REPLY_INTEGER:
+        return 3 + snprintf(num, sizeof(num), "%lld", r->integer);
+    case REDIS_REPLY_NIL:
+        return 5;
+    default:
+        return 3 + r->len;
     }
+}
 
-    return now_us() - t1;
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
 }
 
-long long query_select_all(redisContext *c, int rows) {
+static void* query_thread(void *arg) {
+    QueryThread *t = (QueryThread*)arg;
+    const char *argv[5 + MAX_COLS];
+    size_t argvlen[5 + MAX_COLS];
+    double *sent = (double*)malloc(sizeof(double) * t->depth);
+    long issued = 0, done = 0;
+
+    pin_thread(t->id);
+    redisContext *c = redis_connect();
+    if (!c || !sent) {
+        t->failed = 1;
+        free(sent);
+        return NULL;
+    }
+    while (done < t->count) {
+        // keep the pipeline full, wait for the oldest reply only when it is
+        if (issued < t->count && issued - done < t->depth) {
+            int argc = t->ops->build(t, t->first + issued, argv, argvlen);
+            if (redisAppendCommandArgv(c, argc, argv, argvlen) != REDIS_OK) {
+                fprintf(stderr, "ERROR: %s: %s\n", t->ops->name, c->errstr);
+                t->failed = 1;
+                break;
+            }
+            sent[issued % t->depth] = now_us_f();
+            issued++;
+            continue;
+        }
+        redisReply *r = NULL;
+        if (redisGetReply(c, (void**)&r) != REDIS_OK || !r) {
+            fprintf(stderr, "ERROR: %s: %s\n", t->ops->name, c->errstr);
+            t->failed = 1;
+            break;
+        }
+        t->lat[done] = now_us_f() - sent[done % t->depth];
+        t->reply_bytes += resp_size(r);
+        if (t->ops->reply) t->ops->reply(t, r);
+        freeReplyObject(r);
+        done++;
+    }
+    redisFree(c);
+    free(sent);
+    return NULL;
+}
+
+// Run ops operations of a workload over gQueryConns connections with depth in flight on each
+static int run_queries(const QueryOps *ops, long n, int rows, int depth, const ColumnMap *map, QueryResult *res) {
+    int conns = gQueryConns;
+    QueryThread threads[MAX_QUERY_CONNS];
+    pthread_t tids[MAX_QUERY_CONNS];
+    double *lat = (double*)malloc(sizeof(double) * (n > 0 ? n : 1));
+    int failed = 0;
+
+    if (!lat) {
+        fprintf(stderr, "ERROR: malloc failed (%ld latencies)\n", n);
+        exit(1);
+    }
+    if (conns > n) conns = n > 0 ? n : 1;
+    memset(res, 0, sizeof(*res));
     long long t1 = now_us();
+    for (int i = 0; i < conns; i++) {
+        QueryThread *t = threads + i;
+        memset(t, 0, sizeof(*t));
+        t->id = i;
+        t->ops = ops;
+        t->first = n * i / conns;
+        t->count = n * (i + 1) / conns - t->first;
+        t->rows = rows;
+        t->depth = depth;
+        t->map = map;
+        t->seed = 42 + i;
+        t->lat = lat + t->first;
+        if (pthread_create(tids + i, NULL, query_thread, t) != 0) {
+            fprintf(stderr, "ERROR: pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < conns; i++) {
+        pthread_join(tids[i], NULL);
+        failed |= threads[i].failed;
+        res->sum += threads[i].sum;
+        res->rows_seen += threads[i].rows_seen;
+        res->reply_bytes += threads[i].reply_bytes;
+        res->inexact |= threads[i].inexact;
+        for (int k = 0; k < MAX_COLS; k++) agg_merge(res->agg + k, threads[i].agg + k);
+    }
+    res->total_us = now_us() - t1;
+    res->ops = n;
+    if (!failed && n > 0) {
+        double total = 0;
+        for (long i = 0; i < n; i++) total += lat[i];
+        qsort(lat, n, sizeof(double), compare_double);
+        res->avg_us = total / n;
+        res->p50_us = lat[n / 2];
+        res->p99_us = lat[n * 99 / 100];
+        res->ops_s = res->total_us ? n * 1e6 / res->total_us : 0.0;
+    }
+    free(lat);
+    return failed ? -1 : 0;
+}
 
-    for (int i = 1; i <= rows; i++) {
-        char key[64];
-        snprintf(key, sizeof(key), "row:%d", i);
+static int build_hgetall(QueryThread *t, long row, const char **argv, size_t *argvlen) {
+    argv[0] = "HGETALL";
+    argvlen[0] = 7;
+    argvlen[1] = snprintf(t->key, sizeof(t->key), "row:%ld", row);
+    argv[1] = t->key;
+    return 2;
+}
 
-        redisReply *r = redisCommand(c, "HGETALL %s", key);
-        if (r) freeReplyObject(r);
+static int build_select_gaussian(QueryThread *t, long i, const char **argv, size_t *argvlen) {
+    (void)i;
+    return build_hgetall(t, gaussian_key(t->rows, &t->seed), argv, argvlen);
+}
+
+static int build_select_row(QueryThread *t, long i, const char **argv, size_t *argvlen) {
+    return build_hgetall(t, i + 1, argv, argvlen);
+}
+
+// HMGET of the mapped fields only, the reply comes back in the map order
+static int build_hmget_row(QueryThread *t, long i, const char **argv, size_t *argvlen) {
+    const ColumnMap *m = t->map;
+    argv[0] = "HMGET";
+    argvlen[0] = 5;
+    argvlen[1] = snprintf(t->key, sizeof(t->key), "row:%ld", i + 1);
+    argv[1] = t->key;
+    memcpy(argv + 2, m->name, sizeof(m->name[0]) * m->n);
+    memcpy(argvlen + 2, m->len, sizeof(m->len[0]) * m->n);
+    return 2 + m->n;
+}
+
+// Sum of the integer fields of an HMGET reply, positions known from the map
+static void reply_sum_int_columns(QueryThread *t, redisReply *r) {
+    if (r->type != REDIS_REPLY_ARRAY || (int)r->elements != t->map->n) return;
+
+    long long row_sum = 0;
+    for (int k = 0; k < t->map->n; k++) {
+        const redisReply *f = r->element[k];
+        if (t->map->is_int[k] && f && f->type == REDIS_REPLY_STRING && f->len) {
+            long long v = parse_int_fast(f->str, f->len);
+            row_sum += v;
+            agg_add(t->agg + k, v);
+        }
     }
+    t->sum += row_sum;
+    t->rows_seen++;
+}
 
-    return now_us() - t1;
+static int build_get_rowb(QueryThread *t, long row, const char **argv, size_t *argvlen) {
+    argv[0] = "GET";
+    argvlen[0] = 3;
+    argvlen[1] = snprintf(t->key, sizeof(t->key), "rowb:%ld", row);
+    argv[1] = t->key;
+    return 2;
 }
 
-long long query_projection_generic(
-    redisContext *c,
-    int rows,
-    Column *schema,
-    int ns
-) {
-    long long t1 = now_us();
-    long long total_sum = 0;
-    int count = 0;
+static int build_select_gaussian_rowb(QueryThread *t, long i, const char **argv, size_t *argvlen) {
+    (void)i;
+    return build_get_rowb(t, gaussian_key(t->rows, &t->seed), argv, argvlen);
+}
 
-    for (int i = 1; i <= rows; i++) {
-        char key[64];
-        snprintf(key, sizeof(key), "row:%d", i);
+static int build_select_rowb(QueryThread *t, long i, const char **argv, size_t *argvlen) {
+    return build_get_rowb(t, i + 1, argv, argvlen);
+}
+
+// Header and slots of a binary row up to the last mapped column, the bytes
+// of the strings stay on the server
+static int build_getrange_rowb(QueryThread *t, long i, const char **argv, size_t *argvlen) {
+    const ColumnMap *m = t->map;
+
+    argv[0] = "GETRANGE";
+    argvlen[0] = 8;
+    argvlen[1] = snprintf(t->key, sizeof(t->key), "rowb:%ld", i + 1);
+    argv[1] = t->key;
+    argv[2] = "0";
+    argvlen[2] = 1;
+    argvlen[3] = snprintf(t->range[0], sizeof(t->range[0]), "%zu", ROWB_SLOT(m->n ? m->col[m->n - 1] + 1 : 0) - 1);
+    argv[3] = t->range[0];
+    return 4;
+}
 
-        redisReply *r = redisCommand(c, "HGETALL %s", key);
-        if (!r || r->type != REDIS_REPLY_ARRAY) {
-            if (r) freeReplyObject(r);
+// Decode every column of a binary row in place, the integers are summed and
+// the strings must lie in the row
+static void reply_decode_rowb(QueryThread *t, redisReply *r) {
+    const ColumnMap *m = t->map;
+
+    if (r->type != REDIS_REPLY_STRING) return;     // missing row
+
+    const char *end = r->str + r->len;
+    long long row_sum = 0;
+    int bad = r->len < ROWB_SLOT(m->n);
+    for (int k = 0; k < m->n && !bad; k++) {
+        if (m->is_int[k]) {
+            if (!rowb_null(r->str, k)) row_sum += rowb_int(r->str, k);
             continue;
         }
+        uint32_t len;
+        const char *s = rowb_str(r->str, k, &len);
+        bad = s < r->str + ROWB_SLOT(m->n) || s > end || len > (size_t)(end - s);
+    }
+    if (bad) {
+        if (!t->failed) fprintf(stderr, "ERROR: %s: corrupt binary row\n", t->ops->name);
+        t->failed = 1;
+        return;
+    }
+    t->sum += row_sum;
+    t->rows_seen++;
+}
 
-        long long row_sum = 0;
+// Sum of the mapped integer columns of a binary row, read in place from the reply
+static void reply_sum_int_columns_rowb(QueryThread *t, redisReply *r) {
+    const ColumnMap *m = t->map;
+
+    // GETRANGE of a missing row is empty, it counts like the all-NULL HMGET
+    // reply of the hash layout
+    if (r->type != REDIS_REPLY_STRING) return;
+
+    long long row_sum = 0;
+    for (int k = 0; k < m->n; k++) {
+        int col = m->col[k];
+        if (!m->is_int[k] || r->len < ROWB_SLOT(col + 1) || rowb_null(r->str, col)) continue;
+        int64_t v = rowb_int(r->str, col);
+        row_sum += v;
+        agg_add(t->agg + k, v);
+    }
+    t->sum += row_sum;
+    t->rows_seen++;
+}
 
-        for (int s = 0; s < ns; s++) {
-            if (!schema[s].is_int) continue;
+static void column_map_add(ColumnMap *m, const Column *schema, int i) {
+    m->name[m->n] = schema[i].name;
+    m->len[m->n] = strlen(schema[i].name);
+    m->is_int[m->n] = schema[i].is_int;
+    m->col[m->n] = i;
+    m->n++;
+}
 
-            for (size_t j = 0; j + 1 < r->elements; j += 2) {
-                if (r->element[j] && r->element[j]->str &&
-                    strcmp(schema[s].name, r->element[j]->str) == 0 &&
-                    r->element[j+1] && r->element[j+1]->str) {
-                    row_sum += atoll(r->element[j+1]->str);
-                }
-            }
+// Map the comma-separated names in the schema, or all the integer columns if names is NULL
+static int build_column_map(const Column *schema, int ns, const char *names, ColumnMap *m) {
+    m->n = 0;
+    for (int i = 0; i < ns; i++) {
+        if (names) {
+            const char *p = names;
+            size_t len = strlen(schema[i].name);
+            // keep the schema order whatever the order on the command line
+            while (p && !(strncmp(p, schema[i].name, len) == 0 && (p[len] == ',' || p[len] == '\0')))
+                p = (p = strchr(p, ',')) ? p + 1 : NULL;
+            if (!p) continue;
+        } else if (!schema[i].is_int) {
+            continue;
         }
+        column_map_add(m, schema, i);
+    }
+    if (names) {
+        // every name must have matched a column
+        int given = 1;
+        for (const char *p = names; *p; p++) given += *p == ',';
+        if (given != m->n) return -1;
+    }
+    return 0;
+}
 
-        total_sum += row_sum;
-        count++;
-
-        freeReplyObject(r);
+// ------------------------------------------------------------
+// Aggregation pushdown: a script computes COUNT/SUM/MIN/MAX of the mapped
+// columns over a range of rows on the server, only the partial aggregates
+// come back and are merged here. The ranges are the operations of the
+// workload, so they run concurrently over the query connections.
+// ------------------------------------------------------------
+static int gPushdownRange = 1000;   // rows per script call, the server is blocked meanwhile
+static char gPushdownSha[41];
+
+// ARGV: first last column..., returns count sum min max per column and an
+// exact flag. A field counts when non-empty and its value is its leading
+// digits, like parse_int_fast. Lua numbers are doubles: the flag drops to 0
+// once a value or a sum leaves +-2^53, the client results are exact then
+static const char *kPushdownScript =
+    "local first, last = tonumber(ARGV[1]), tonumber(ARGV[2])\n"
+    "local n = #ARGV - 2\n"
+    "local big = 2 ^ 53\n"
+    "local exact = 1\n"
+    "local cnt, sum, min, max = {}, {}, {}, {}\n"
+    "for k = 1, n do cnt[k] = 0; sum[k] = 0; min[k] = 0; max[k] = 0 end\n"
+    "for i = first, last do\n"
+    "  local v = redis.call('HMGET', 'row:' .. i, unpack(ARGV, 3))\n"
+    "  for k = 1, n do\n"
+    "    if v[k] and #v[k] > 0 then\n"
+    "      local x = tonumber(string.match(v[k], '^-?%d+')) or 0\n"
+    "      if cnt[k] == 0 or x < min[k] then min[k] = x end\n"
+    "      if cnt[k] == 0 or x > max[k] then max[k] = x end\n"
+    "      cnt[k] = cnt[k] + 1\n"
+    "      sum[k] = sum[k] + x\n"
+    "      if x >= big or x <= -big or sum[k] >= big or sum[k] <= -big then exact = 0 end\n"
+    "    end\n"
+    "  end\n"
+    "end\n"
+    "local out = {}\n"
+    "for k = 1, n do\n"
+    "  out[4 * k - 3] = cnt[k]; out[4 * k - 2] = sum[k]; out[4 * k - 1] = min[k]; out[4 * k] = max[k]\n"
+    "end\n"
+    "out[4 * n + 1] = exact\n"
+    "return out\n";
+
+// Load the script once, its SHA1 is what the connections call
+static int pushdown_load(redisContext *c) {
+    const char *argv[3] = {"SCRIPT", "LOAD", kPushdownScript};
+    size_t argvlen[3] = {6, 4, strlen(kPushdownScript)};
+    redisReply *r = redisCommandArgv(c, 3, argv, argvlen);
+
+    if (!r || r->type != REDIS_REPLY_STRING || r->len != 40) {
+        fprintf(stderr, "ERROR: SCRIPT LOAD failed: %s\n", r && r->str ? r->str : c->errstr);
+        if (r) freeReplyObject(r);
+        return -1;
     }
+    memcpy(gPushdownSha, r->str, 41);
+    freeReplyObject(r);
+    return 0;
+}
 
-    double avg = count ? (double)total_sum / count : 0.0;
-    printf("AVG(sum(int_columns)) = %.2f\n", avg);
+static int build_pushdown(QueryThread *t, long i, const char **argv, size_t *argvlen) {
+    const ColumnMap *m = t->map;
+    long first = i * gPushdownRange + 1;
+    long last = first + gPushdownRange - 1 < t->rows ? first + gPushdownRange - 1 : t->rows;
+
+    argv[0] = "EVALSHA";
+    argvlen[0] = 7;
+    argv[1] = gPushdownSha;
+    argvlen[1] = 40;
+    argv[2] = "0";
+    argvlen[2] = 1;
+    argvlen[3] = snprintf(t->range[0], sizeof(t->range[0]), "%ld", first);
+    argv[3] = t->range[0];
+    argvlen[4] = snprintf(t->range[1], sizeof(t->range[1]), "%ld", last);
+    argv[4] = t->range[1];
+    memcpy(argv + 5, m->name, sizeof(m->name[0]) * m->n);
+    memcpy(argvlen + 5, m->len, sizeof(m->len[0]) * m->n);
+    return 5 + m->n;
+}
 
-    return now_us() - t1;
+static void reply_pushdown(QueryThread *t, redisReply *r) {
+    if (r->type != REDIS_REPLY_ARRAY || (int)r->elements != 4 * t->map->n + 1) {
+        if (!t->failed)
+            fprintf(stderr, "ERROR: %s: %s\n", t->ops->name, r->type == REDIS_REPLY_ERROR ? r->str : "unexpected reply");
+        t->failed = 1;
+        return;
+    }
+    for (int k = 0; k < t->map->n; k++) {
+        ColumnAgg part = {r->element[4 * k]->integer, r->element[4 * k + 1]->integer,
+                          r->element[4 * k + 2]->integer, r->element[4 * k + 3]->integer};
+        agg_merge(t->agg + k, &part);
+        t->sum += part.sum;
+    }
+    t->inexact |= !r->element[4 * t->map->n]->integer;
 }
 
-long long query_aggregation_generic(
-    redisContext *c,
-    int rows,
-    Column *schema,
-    int ns
-) {
-    long long t1 = now_us();
-    long long global_sum = 0;
+static const QueryOps query_select_gaussian = {"SELECT (Gauss)", build_select_gaussian, NULL};
+static const QueryOps query_select_all      = {"SELECTION *", build_select_row, NULL};
+static const QueryOps query_projection      = {"PROJECTION", build_hmget_row, reply_sum_int_columns};
+static const QueryOps query_aggregation     = {"AGGREGATION", build_hmget_row, reply_sum_int_columns};
+static const QueryOps query_pushdown        = {"PUSHDOWN", build_pushdown, reply_pushdown};
+static const QueryOps query_select_gaussian_rowb = {"BIN SELECT (G)", build_select_gaussian_rowb, reply_decode_rowb};
+static const QueryOps query_select_all_rowb      = {"BIN SELECTION *", build_select_rowb, reply_decode_rowb};
+static const QueryOps query_projection_rowb      = {"BIN PROJECTION", build_getrange_rowb, reply_sum_int_columns_rowb};
+static const QueryOps query_aggregation_rowb     = {"BIN AGGREGATION", build_getrange_rowb, reply_sum_int_columns_rowb};
 
-    for (int i = 1; i <= rows; i++) {
-        char key[64];
-        snprintf(key, sizeof(key), "row:%d", i);
+// ------------------------------------------------------------
+// Column cache scans: the rows are split over gQueryConns pinned threads at
+// bitmap word boundaries, the blocks of 64 rows without NULL are aggregated
+// with NEON (or whatever the compiler makes of the loop elsewhere), the
+// others bit by bit.
+// ------------------------------------------------------------
+typedef struct {
+    int id;
+    long begin, end;        // rows [begin, end), begin a multiple of 64
+    const ColumnMap *map;
+    ColumnAgg agg[MAX_COLS];
+} ScanThread;
+
+// Aggregate 64 present values
+static inline void scan_block(const int64_t *v, ColumnAgg *a) {
+    ColumnAgg blk = {64, 0, v[0], v[0]};
+#if defined(__aarch64__)
+    int64x2_t s0 = vdupq_n_s64(0), s1 = s0;
+    int64x2_t mn0 = vld1q_s64(v), mn1 = mn0, mx0 = mn0, mx1 = mn0;
+    for (int i = 0; i < 64; i += 4) {
+        int64x2_t x0 = vld1q_s64(v + i), x1 = vld1q_s64(v + i + 2);
+        s0 = vaddq_s64(s0, x0);
+        s1 = vaddq_s64(s1, x1);
+        // no 64-bit vector min/max, compare and select
+        mn0 = vbslq_s64(vcgtq_s64(mn0, x0), x0, mn0);
+        mn1 = vbslq_s64(vcgtq_s64(mn1, x1), x1, mn1);
+        mx0 = vbslq_s64(vcgtq_s64(x0, mx0), x0, mx0);
+        mx1 = vbslq_s64(vcgtq_s64(x1, mx1), x1, mx1);
+    }
+    s0 = vaddq_s64(s0, s1);
+    mn0 = vbslq_s64(vcgtq_s64(mn0, mn1), mn1, mn0);
+    mx0 = vbslq_s64(vcgtq_s64(mx1, mx0), mx1, mx0);
+    blk.sum = vgetq_lane_s64(s0, 0) + vgetq_lane_s64(s0, 1);
+    blk.min = vgetq_lane_s64(mn0, 0) < vgetq_lane_s64(mn0, 1) ? vgetq_lane_s64(mn0, 0) : vgetq_lane_s64(mn0, 1);
+    blk.max = vgetq_lane_s64(mx0, 0) > vgetq_lane_s64(mx0, 1) ? vgetq_lane_s64(mx0, 0) : vgetq_lane_s64(mx0, 1);
+#else
+    for (int i = 0; i < 64; i++) {
+        blk.sum += v[i];
+        blk.min = v[i] < blk.min ? v[i] : blk.min;
+        blk.max = v[i] > blk.max ? v[i] : blk.max;
+    }
+#endif
+    agg_merge(a, &blk);
+}
 
-        redisReply *r = redisCommand(c, "HGETALL %s", key);
-        if (!r || r->type != REDIS_REPLY_ARRAY) {
-            if (r) freeReplyObject(r);
+static void scan_column(const int64_t *data, const uint64_t *valid, long begin, long end, ColumnAgg *a) {
+    for (long base = begin; base < end; base += 64) {
+        uint64_t bits = valid[base >> 6];
+        if (end - base < 64) bits &= (1ULL << (end - base)) - 1;
+        if (bits == ~0ULL) {
+            scan_block(data + base, a);
             continue;
         }
+        for (; bits; bits &= bits - 1)
+            agg_add(a, data[base + __builtin_ctzll(bits)]);
+    }
+}
 
-        for (int s = 0; s < ns; s++) {
-            if (!schema[s].is_int) continue;
+static void* scan_thread(void *arg) {
+    ScanThread *t = (ScanThread*)arg;
 
-            for (size_t j = 0; j + 1 < r->elements; j += 2) {
-                if (r->element[j] && r->element[j]->str &&
-                    strcmp(schema[s].name, r->element[j]->str) == 0 &&
-                    r->element[j+1] && r->element[j+1]->str) {
-                    global_sum += atoll(r->element[j+1]->str);
-                }
-            }
+    pin_thread(t->id);
+    for (int k = 0; k < t->map->n; k++) {
+        int col = t->map->col[k];
+        if (gCache.data[col])
+            scan_column(gCache.data[col], gCache.valid[col], t->begin, t->end, t->agg + k);
+    }
+    return NULL;
+}
+
+// Aggregate the mapped columns of the cache, returns the time in us
+static long long run_column_scan(const ColumnMap *map, ColumnAgg *agg) {
+    long words = (gCache.rows + 63) / 64;
+    int nthreads = gQueryConns < words ? gQueryConns : (words ? words : 1);
+    ScanThread threads[MAX_QUERY_CONNS];
+    pthread_t tids[MAX_QUERY_CONNS];
+
+    memset(agg, 0, sizeof(ColumnAgg) * MAX_COLS);
+    long long t1 = now_us();
+    for (int i = 0; i < nthreads; i++) {
+        ScanThread *t = threads + i;
+        memset(t, 0, sizeof(*t));
+        t->id = i;
+        t->begin = words * i / nthreads * 64;
+        t->end = words * (i + 1) / nthreads * 64;
+        if (t->end > gCache.rows) t->end = gCache.rows;
+        t->map = map;
+        if (pthread_create(tids + i, NULL, scan_thread, t) != 0) {
+            fprintf(stderr, "ERROR: pthread_create failed\n");
+            exit(1);
         }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        for (int k = 0; k < map->n; k++) agg_merge(agg + k, threads[i].agg + k);
+    }
+    return now_us() - t1;
+}
 
-        freeReplyObject(r);
+// COUNT/SUM/AVG/MIN/MAX per column of an aggregation
+static void print_aggregates(const char *name, const ColumnMap *m, const ColumnAgg *agg) {
+    printf("\n%s:\n", name);
+    printf("%-16s %10s %20s %14s %20s %20s\n", "Column", "COUNT", "SUM", "AVG", "MIN", "MAX");
+    for (int k = 0; k < m->n; k++) {
+        printf("%-16s %10lld %20lld %14.2f %20lld %20lld\n", m->name[k], agg[k].count, agg[k].sum,
+               agg[k].count ? (double)agg[k].sum / agg[k].count : 0.0, agg[k].min, agg[k].max);
+    }
+}
+
+// Parse a list of depths like 1,16,128
+static int parse_depths(const char *text) {
+    char *end;
+    gNumQueryDepths = 0;
+    while (*text && gNumQueryDepths < MAX_QUERY_DEPTHS) {
+        long d = strtol(text, &end, 10);
+        if (end == text || d < 1) return -1;
+        gQueryDepths[gNumQueryDepths++] = d;
+        text = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return -1;
     }
+    return gNumQueryDepths ? 0 : -1;
+}
 
-    printf("SUM(int_columns) = %lld\n", global_sum);
-    return now_us() - t1;
+// Memory of a key as MEMORY USAGE reports it, 0 if it cannot
+static long long key_memory(redisContext *c, const char *key) {
+    redisReply *reply = redisCommand(c, "MEMORY USAGE %s SAMPLES 0", key);
+    long long n = reply && reply->type == REDIS_REPLY_INTEGER ? reply->integer : 0;
+    if (reply) freeReplyObject(reply);
+    return n;
+}
+
+// Hash rows against binary rows, MEMORY USAGE of up to 1000 rows spread over the dataset
+void print_layout_memory(redisContext *c, int rows) {
+    long long hash = 0, bin = 0;
+    int samples = rows < 1000 ? rows : 1000;
+    char key[64];
+
+    for (int i = 0; i < samples; i++) {
+        int row = 1 + (long long)rows * i / samples;
+        snprintf(key, sizeof(key), "row:%d", row);
+        hash += key_memory(c, key);
+        snprintf(key, sizeof(key), "rowb:%d", row);
+        bin += key_memory(c, key);
+    }
+    if (!samples || !hash || !bin) return;
+    printf("Hash rows:   %8.1f bytes/row, %10.1f MB for %d rows\n", (double)hash / samples,
+           (double)hash / samples * rows / (1 << 20), rows);
+    printf("Binary rows: %8.1f bytes/row, %10.1f MB for %d rows (%.2fx smaller)\n", (double)bin / samples,
+           (double)bin / samples * rows / (1 << 20), rows, (double)hash / bin);
 }
 
 /* ---------------- PERSISTENCE ---------------- */
@@ -417,10 +1621,89 @@ void print_memory(redisContext *c) {
     free(dup);
 }
 
+static void usage(const char *prog) {
+    printf("Usage:\n");
+    printf("  %s [-d depth] [-j threads] [-c chunk_mb] [-q depth,...] [-n conns] [-p col,...] [-r rows] [-m rows] [-b] 0|1 full|load dataset.csv [enzian_dev=/dev/enzian_memory] [map_gb=4]\n", prog);
+    printf("  -d depth    replies in flight per connection when loading (default %d)\n", gPipelineDepth);
+    printf("  -j threads  pinned loader threads, one connection each (default %d)\n", gLoadThreads);
+    printf("  -c chunk_mb size of the two buffers the dataset is streamed through (default %zu)\n", gChunkBytes >> 20);
+    printf("  -q depths   queries in flight per connection, the workloads run for each (default 1,16,128)\n");
+    printf("  -n conns    query connections, one pinned thread each (default %d)\n", gQueryConns);
+    printf("  -p cols     comma-separated columns the projection fetches (default the integer columns)\n");
+    printf("  -r rows     rows aggregated per server-side script call (default %d)\n", gPushdownRange);
+    printf("  -b          also store every row as one binary string, rowb:N, and query both layouts\n");
+    printf("  -m rows     room of the integer column cache in rows, 0 disables it (default estimated from the file size)\n");
+}
+
 int main(int argc, char **argv) {
+    const char *prog = argv[0];
+    int opt;
+    while ((opt = getopt(argc, argv, "hbd:j:c:q:n:p:r:m:")) != -1) {
+        switch (opt) {
+        case 'd':
+            gPipelineDepth = atoi(optarg);
+            if (gPipelineDepth < 1) {
+                fprintf(stderr, "ERROR: invalid pipeline depth %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'j':
+            gLoadThreads = atoi(optarg);
+            if (gLoadThreads < 1 || gLoadThreads > MAX_LOAD_THREADS) {
+                fprintf(stderr, "ERROR: invalid number of threads %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            if (atol(optarg) < 1) {
+                fprintf(stderr, "ERROR: invalid chunk size %s\n", optarg);
+                return 1;
+            }
+            gChunkBytes = (size_t)atol(optarg) << 20;
+            break;
+        case 'q':
+            if (parse_depths(optarg) != 0) {
+                fprintf(stderr, "ERROR: invalid depths %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            gQueryConns = atoi(optarg);
+            if (gQueryConns < 1 || gQueryConns > MAX_QUERY_CONNS) {
+                fprintf(stderr, "ERROR: invalid number of connections %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            gProjection = optarg;
+            break;
+        case 'b':
+            gBinaryRows = true;
+            break;
+        case 'm':
+            gColumnCapacity = atol(optarg);
+            if (gColumnCapacity < 0) {
+                fprintf(stderr, "ERROR: invalid column cache size %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            gPushdownRange = atoi(optarg);
+            if (gPushdownRange < 1) {
+                fprintf(stderr, "ERROR: invalid pushdown range %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(prog);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc < 4) {
-        printf("Usage:\n");
-        printf("  %s 0|1 full|load dataset.csv [enzian_dev=/dev/enzian_memory] [map_gb=4]\n", argv[0]);
+        usage(prog);
         return 1;
     }
 
@@ -441,12 +1724,8 @@ int main(int argc, char **argv) {
     Column schema[MAX_COLS];
     int ns = 0;
 
-    redisContext *c = redisConnect("127.0.0.1", 6369);
-    if (!c || c->err) {
-        printf("Redis connection error\n");
-        if (c) redisFree(c);
-        return 1;
-    }
+    redisContext *c = redis_connect();
+    if (!c) return 1;
 
     printf("Connected to Redis\n");
     set_persistence(c, persistent);
@@ -461,39 +1740,113 @@ int main(int argc, char **argv) {
         return 0;
     }
 
-    /* ---------------- RUN QUERIES ---------------- */
-    long long t_select_gauss = query_select_gaussian(c, row_count);
-    long long t_select_all   = query_select_all(c, row_count);
-    long long t_projection   = query_projection_generic(c, row_count, schema, ns);
-    long long t_aggregation  = query_aggregation_generic(c, row_count, schema, ns);
-
-    /* ---------------- LATENCY SUMMARY ---------------- */
-    double avg_select_gauss = (double)t_select_gauss / row_count;
-    double avg_select_all   = (double)t_select_all   / row_count;
-    double avg_projection   = (double)t_projection   / row_count;
-    double avg_aggregation  = (double)t_aggregation  / row_count;
-
-    double base = (double)t_select_gauss;
-
-    printf("\n=== LATENCY SUMMARY (microseconds) ===\n");
-    printf("Workload        | Total Time           | Avg Latency        | Relative Cost\n");
-    printf("--------------------------------------------------------------------------\n");
+    /* ---------------- RUN QUERIES, FOR EVERY DEPTH ---------------- */
+    const QueryOps *workloads[] = {&query_select_gaussian, &query_select_all, &query_projection, &query_aggregation,
+                                   &query_pushdown, &query_select_gaussian_rowb, &query_select_all_rowb,
+                                   &query_projection_rowb, &query_aggregation_rowb};
+    const long nops[] = {row_count, row_count, row_count, row_count, (row_count + gPushdownRange - 1) / gPushdownRange,
+                         row_count, row_count, row_count, row_count};
+    const int nworkloads = gBinaryRows ? 9 : 5;  // the binary rows are only there with -b
+    ColumnMap int_map, proj_map, all_map = {0};
+
+    build_column_map(schema, ns, NULL, &int_map);
+    for (int i = 0; i < ns; i++) column_map_add(&all_map, schema, i);
+    if (build_column_map(schema, ns, gProjection, &proj_map) != 0) {
+        fprintf(stderr, "ERROR: unknown column in projection %s\n", gProjection);
+        redisFree(c);
+        return 1;
+    }
+    const ColumnMap *maps[] = {NULL, NULL, &proj_map, &int_map, &int_map, &all_map, &all_map, &proj_map, &int_map};
+    QueryResult best[sizeof(workloads) / sizeof(workloads[0])];   // fastest depth of each workload
+    const int pushdown = int_map.n > 0;   // the script needs at least one integer column
 
-    printf("SELECT (Gauss)  | total = %10lld us | avg = %8.2f us/op | slowdown = %6.2fx\n",
-           t_select_gauss, avg_select_gauss, 1.00);
+    if (!pushdown)
+        printf("No integer column, no aggregation pushdown\n");
+    else if (pushdown_load(c) != 0) {
+        redisFree(c);
+        return 1;
+    }
 
-    printf("SELECTION *     | total = %10lld us | avg = %8.2f us/op | slowdown = %6.2fx\n",
-           t_select_all, avg_select_all, (double)t_select_all / base);
+    for (int d = 0; d < gNumQueryDepths; d++) {
+        QueryResult res[sizeof(workloads) / sizeof(workloads[0])];
 
-    printf("PROJECTION      | total = %10lld us | avg = %8.2f us/op | slowdown = %6.2fx\n",
-           t_projection, avg_projection, (double)t_projection / base);
+        for (int w = 0; w < nworkloads; w++) {
+            if (w == 4 && !pushdown) continue;
+            if (run_queries(workloads[w], nops[w], row_count, gQueryDepths[d], maps[w], res + w) != 0) {
+                redisFree(c);
+                return 1;
+            }
+            if (d == 0 || res[w].total_us < best[w].total_us) best[w] = res[w];
+        }
+        printf("\nAVG(sum(%s)) = %.2f\n", gProjection ? gProjection : "int_columns", res[2].rows_seen ? (double)res[2].sum / res[2].rows_seen : 0.0);
+        printf("SUM(int_columns) = %lld\n", res[3].sum);
+        if (pushdown)
+            printf("SUM(int_columns) pushed down = %lld (%s, %lld vs %lld reply bytes)\n", res[4].sum,
+                   res[4].inexact ? "inexact, past 2^53 in Lua"
+                   : memcmp(res[3].agg, res[4].agg, sizeof(ColumnAgg) * int_map.n) ? "MISMATCH" : "matches",
+                   res[4].reply_bytes, res[3].reply_bytes);
+        if (gBinaryRows) {
+            printf("SUM(int_columns) decoded from the binary rows = %lld (%s)\n", res[6].sum, res[6].sum == res[3].sum ? "matches" : "MISMATCH");
+            printf("AVG(sum(%s)) binary rows = %.2f (%s)\n", gProjection ? gProjection : "int_columns",
+                   res[7].rows_seen ? (double)res[7].sum / res[7].rows_seen : 0.0, res[7].sum == res[2].sum ? "matches" : "MISMATCH");
+            printf("SUM(int_columns) binary rows = %lld (%s, %lld vs %lld reply bytes)\n", res[8].sum,
+                   memcmp(res[3].agg, res[8].agg, sizeof(ColumnAgg) * int_map.n) ? "MISMATCH" : "matches",
+                   res[8].reply_bytes, res[3].reply_bytes);
+        }
+        if (d == 0 && pushdown) print_aggregates("Aggregates (pushdown)", &int_map, res[4].agg);
+
+        /* ---------------- LATENCY SUMMARY ---------------- */
+        double base = (double)res[0].total_us;
+
+        printf("\n=== LATENCY SUMMARY (microseconds), depth %d, %d connection(s) ===\n", gQueryDepths[d], gQueryConns);
+        printf("Workload        | Total Time           | Throughput          | Avg Latency        | p50      | p99      | Received   | Relative Cost\n");
+        printf("--------------------------------------------------------------------------------------------------------------------------------------\n");
+        for (int w = 0; w < nworkloads; w++) {
+            if (w == 4 && !pushdown) continue;
+            printf("%-15s | total = %10lld us | %10.0f ops/s | avg = %8.2f us/op | %8.2f | %8.2f | %7lld KB | slowdown = %6.2fx\n",
+                   workloads[w]->name, res[w].total_us, res[w].ops_s, res[w].avg_us, res[w].p50_us, res[w].p99_us,
+                   res[w].reply_bytes >> 10, base ? res[w].total_us / base : 0.0);
+        }
+    }
 
-    printf("AGGREGATION     | total = %10lld us | avg = %8.2f us/op | slowdown = %6.2fx\n",
-           t_aggregation, avg_aggregation, (double)t_aggregation / base);
+    /* ---------------- COLUMN CACHE SCANS ---------------- */
+    if (gCache.cap && !gCache.overflow) {
+        ColumnAgg proj_agg[MAX_COLS], int_agg[MAX_COLS];
+        long long proj_sum = 0, int_sum = 0, proj_bytes = 0, int_bytes = 0;
+
+        run_column_scan(&int_map, int_agg);    // warm up
+        long long proj_us = run_column_scan(&proj_map, proj_agg);
+        long long int_us = run_column_scan(&int_map, int_agg);
+        for (int k = 0; k < proj_map.n; k++) {
+            proj_sum += proj_agg[k].sum;
+            proj_bytes += proj_map.is_int[k] ? gCache.rows * (sizeof(int64_t) + 1.0 / 8) : 0;
+        }
+        for (int k = 0; k < int_map.n; k++) int_sum += int_agg[k].sum;
+        int_bytes = int_map.n * gCache.rows * (sizeof(int64_t) + 1.0 / 8);
+
+        printf("\nAVG(sum(%s)) from the column cache = %.2f (%s)\n", gProjection ? gProjection : "int_columns",
+               row_count ? (double)proj_sum / row_count : 0.0, proj_sum == best[2].sum ? "matches" : "MISMATCH");
+        printf("SUM(int_columns) from the column cache = %lld (%s)\n", int_sum,
+               memcmp(int_agg, best[3].agg, sizeof(ColumnAgg) * int_map.n) ? "MISMATCH" : "matches");
+
+        printf("\n=== COLUMN CACHE SCANS (microseconds), %ld rows in %s, %d thread(s) ===\n", gCache.rows,
+               gArenaBase ? "FPGA memory" : "heap", gQueryConns);
+        printf("Workload        | Total Time           | Scan Rate           | Bandwidth    | Speedup over the fastest Redis run\n");
+        printf("----------------------------------------------------------------------------------------------------------\n");
+        printf("%-15s | total = %10lld us | %10.0f rows/s | %7.2f GB/s | %8.1fx\n", "PROJECTION", proj_us,
+               proj_us ? gCache.rows * 1e6 / proj_us : 0.0, proj_us ? proj_bytes / 1e3 / proj_us : 0.0,
+               proj_us ? (double)best[2].total_us / proj_us : 0.0);
+        printf("%-15s | total = %10lld us | %10.0f rows/s | %7.2f GB/s | %8.1fx\n", "AGGREGATION", int_us,
+               int_us ? gCache.rows * 1e6 / int_us : 0.0, int_us ? int_bytes / 1e3 / int_us : 0.0,
+               int_us ? (double)best[3].total_us / int_us : 0.0);
+    } else if (gCache.overflow) {
+        printf("\nColumn cache dropped: %d rows, more than its %ld, no scans (see -m)\n", row_count, gCache.cap);
+    }
 
     /* ---------------- MEMORY USAGE ---------------- */
     printf("\n--- MEMORY USAGE ---\n");
     print_memory(c);
+    if (gBinaryRows) print_layout_memory(c, row_count);
 
     redisFree(c);
     return 0;